@@ -8,12 +8,29 @@
 // Modified code after here
 
 #include <dimmer.h>
+#include <string.h>
+#include "freertos/semphr.h"
+
+#if CONFIG_DIMMER_NO_HEAP
+// any heap allocation left in this file is a build error
+#undef xQueueCreate
+#undef xSemaphoreCreateBinary
+#undef xSemaphoreCreateMutex
+#pragma GCC poison malloc calloc realloc free strdup
+#pragma GCC poison xTaskCreate xTaskCreatePinnedToCore xQueueCreate xQueueGenericCreate
+#pragma GCC poison xSemaphoreCreateBinary xSemaphoreCreateMutex xEventGroupCreate xTimerCreate
+#endif
 
 const static char *TAG = "dimmer";
 
 int8_t global_dimmer_groups[SOC_MCPWM_GROUPS] = { -1, -1 };
 uint32_t global_dimmer_generators = 0UL;
 
+static dimmer_group_t* global_dimmer_group_list = NULL;
+
+static uint32_t budget_request( dimmer_budget_channel_t* channel, uint16_t dutty );
+static BaseType_t budget_send( dimmer_budget_t* budget, dimmer_budget_channel_t* changed, uint32_t priorities );
+
 // internal use functions
 
 // float auto_frequency(uint8_t sync_gpio) {
@@ -52,6 +69,26 @@ uint8_t set_group_id( uint8_t sync_gpio) {
     return group_id;
 }
 
+/**
+ * This function will convert a power value into a dutty cycle
+ * @param power the power in range [0 - 1]
+ * @return uint16_t the dutty cycle 0 - 1000, not inverted
+*/
+static uint16_t power_to_dutty( double power ) {
+    if( power <= 0 ) {
+        return 0;
+    }
+    if( power >= 1) {
+        return 1000; // avoid floating point errors
+    }
+    /** 
+     * Calculate the dutty cycle
+     * t = acos(1 - 2 * power) / (2 * pi * freq)
+     * dutty = 1000 * t * 2 * freq
+     **/
+    return (uint16_t) round(1000 * acos(1 - 2*power) / (M_PI)); // result is in ticks 0 - 1000
+}
+
 esp_err_t validate_generator( uint8_t gen_gpio) {
 
 ESP_LOGI(TAG, "Validating generator GPIO");
@@ -213,24 +250,8 @@ esp_err_t set_dutty( dimmer_t *dimmer, uint16_t dutty ) {
 */
 esp_err_t set_power(dimmer_t *dimmer, double power) {
 
-    uint16_t dutty;
-    if( power <= 0 ) {
-        dutty = 0;
-    }
-    else if( power >= 1) {
-        dutty = 1000; // avoid floating point errors
-    }
-    else {
-        /** 
-         * Calculate the dutty cycle
-         * t = acos(1 - 2 * power) / (2 * pi * freq)
-         * dutty = 1000 * t * 2 * freq
-         **/
-        dutty = (uint16_t) round(1000 * acos(1 - 2*power) / (M_PI)); // result is in ticks 0 - 1000
-    }
-
     // Convert power to dutty
-    set_dutty(dimmer, dutty);
+    set_dutty(dimmer, power_to_dutty(power));
 
     return ESP_OK;
 }
@@ -267,18 +288,27 @@ float get_power(dimmer_t *dimmer) {
 
 /** -------------------------( Task Dimmer Related )------------------------- */
 
+typedef struct {
+    uint8_t             gen_gpio;   // GPIO of the PWM signal
+    uint8_t             sync_gpio;  // GPIO of the zero-crossing signal
+    SemaphoreHandle_t   copied;     // given once the task holds its own copy
+} task_dimmer_args_t;
+
 /**
  * This function will create a task to control the dimmer
- * @param *arg a pointer to the task_dimmer_t struct wich contains necessary information to create the task
+ * @param *arg a pointer to the task_dimmer_args_t struct, only valid until copied is given
  * @return void
 */
 void task_dimmer(void *arg) {
     
-    // Retrieve the arguments
-    task_dimmer_t *args = (task_dimmer_t *)arg;
+    // Retrieve the arguments, they live on the stack of the creator
+    task_dimmer_args_t *args = (task_dimmer_args_t *)arg;
+    uint8_t gen_gpio = args->gen_gpio;
+    uint8_t sync_gpio = args->sync_gpio;
+    xSemaphoreGive(args->copied);
 
-    ESP_ERROR_CHECK(validate_generator(args->gen_gpio));
-    uint8_t group_id = set_group_id(args->sync_gpio);
+    ESP_ERROR_CHECK(validate_generator(gen_gpio));
+    uint8_t group_id = set_group_id(sync_gpio);
     
     #ifdef CONFIG_FREQUENCY_60HZ
         float heartz = 60;
@@ -321,7 +351,7 @@ void task_dimmer(void *arg) {
     ESP_LOGI(TAG, "Create generators");
     mcpwm_gen_handle_t generator;
     mcpwm_generator_config_t gen_config = {
-        .gen_gpio_num = args->gen_gpio,
+        .gen_gpio_num = gen_gpio,
     };
     ESP_ERROR_CHECK(mcpwm_new_generator(operator, &gen_config, &generator));
 
@@ -343,7 +373,7 @@ void task_dimmer(void *arg) {
     mcpwm_sync_handle_t gpio_sync_source = NULL;
     mcpwm_gpio_sync_src_config_t gpio_sync_config = {
         .group_id = group_id,  // GPIO fault should be in the same group of the above timers
-        .gpio_num = args->sync_gpio,
+        .gpio_num = sync_gpio,
         .flags.pull_down = false,
         .flags.pull_up = false,
         .flags.active_neg = false,
@@ -370,6 +400,18 @@ void task_dimmer(void *arg) {
     }
 }
 
+/**
+ * This function will wait for a new dimmer task to copy its arguments,
+ * so they can live on the stack of the creator
+ * @param *args a pointer to the task_dimmer_args_t struct given to the task
+ * @return void
+*/
+static void wait_task_dimmer_args( task_dimmer_args_t* args ) {
+    xSemaphoreTake(args->copied, portMAX_DELAY);
+    vSemaphoreDelete(args->copied);
+}
+
+#if !CONFIG_DIMMER_NO_HEAP
 /**
  * This function will create the dimmer struct and the task to control the dimmer
  * @param gen_gpio the GPIO number to generate the PWM signal
@@ -382,14 +424,60 @@ task_dimmer_t create_task_dimmer( uint8_t gen_gpio, uint8_t sync_gpio) {
         .gen_gpio = gen_gpio,
         .sync_gpio = sync_gpio,
         .dutty = 0,
+        .budget = NULL,
         // .queue = xQueueCreate(3, sizeof(uint16_t)), // hardcoded to 3 elements
     };
     // if ( dimmer.queue == NULL) {
     //     ESP_LOGE(TAG, "Failed to create queue");
     // }
-    xTaskCreate(task_dimmer, "task_dimmer", 4096, (void*)&dimmer, 5, &dimmer.task);
+    StaticSemaphore_t copied;
+    task_dimmer_args_t args = {
+        .gen_gpio = gen_gpio,
+        .sync_gpio = sync_gpio,
+        .copied = xSemaphoreCreateBinaryStatic(&copied),
+    };
+    if( xTaskCreate(task_dimmer, "task_dimmer", CONFIG_DIMMER_TASK_STACK, (void*)&args, 5, &dimmer.task) == pdPASS ) {
+        wait_task_dimmer_args(&args);
+    }
+    else {
+        ESP_LOGE(TAG, "Failed to create the task of the dimmer on GPIO %u", gen_gpio);
+        dimmer.task = NULL;
+    }
     return dimmer;
 }
+#endif
+
+/**
+ * This function will initialize the dimmer struct and create the task to control
+ * the dimmer without heap, the task lives in the given buffers
+ * @param *dimmer a pointer to the task_dimmer_t struct, must live while the dimmer is used
+ * @param gen_gpio the GPIO number to generate the PWM signal
+ * @param sync_gpio the GPIO number to sync the zero-crossing signal
+ * @param *buffers task and stack of the dimmer, must live while the dimmer is used
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG
+*/
+esp_err_t create_task_dimmer_static( task_dimmer_t* dimmer, uint8_t gen_gpio, uint8_t sync_gpio, task_dimmer_static_t* buffers ) {
+    if( dimmer == NULL || buffers == NULL ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *dimmer = (task_dimmer_t) {
+        .task = NULL,
+        .gen_gpio = gen_gpio,
+        .sync_gpio = sync_gpio,
+        .dutty = 0,
+        .budget = NULL,
+    };
+    StaticSemaphore_t copied;
+    task_dimmer_args_t args = {
+        .gen_gpio = gen_gpio,
+        .sync_gpio = sync_gpio,
+        .copied = xSemaphoreCreateBinaryStatic(&copied),
+    };
+    dimmer->task = xTaskCreateStatic(task_dimmer, "task_dimmer", CONFIG_DIMMER_TASK_STACK, (void*)&args, 5, buffers->stack, &buffers->task);
+    wait_task_dimmer_args(&args);
+    return ESP_OK;
+}
 
 /**
  * This function will delete the dimmer task and the queue,
@@ -403,9 +491,23 @@ esp_err_t delete_task_dimmer ( task_dimmer_t* dimmer ) {
     return ESP_OK;
 }
 
+/**
+ * This function will store the dutty cycle of a task dimmer and notify its task
+ * @param *dimmer a pointer to the task_dimmer_t struct
+ * @param dutty the dutty cycle 0 - 1000, not inverted
+ * @return BaseType_t pdPASS or the error of xTaskNotify
+*/
+static BaseType_t notify_task_dimmer( task_dimmer_t* dimmer, uint16_t dutty ) {
+    dimmer->dutty = dutty; // update dutty struct
+
+    // Notify task with the inverted signal
+    return xTaskNotify(dimmer->task, 1000 - dutty, eSetValueWithOverwrite);
+}
+
 /**
  * This function will set the dutty cycle of the dimmer.
- * You can set the power to 0 to stop the dimmer
+ * You can set the power to 0 to stop the dimmer. A dimmer under a power
+ * budget gets the dutty cycle the budget grants
  * @param *dimmer a pointer to the task_dimmer_t struct
  * @param dutty the dutty cycle to set the dimmer to. Must be between 0 and 1000
  * @return esp_err_t ESP_OK
@@ -416,12 +518,17 @@ esp_err_t set_task_dimmer_dutty( task_dimmer_t* dimmer,uint16_t dutty ) {
         dutty = 1000;
     }
 
-    dimmer->dutty = dutty; // update dutty struct
-
-    dutty = 1000 - dutty; // Invert signal
+    if( dimmer->budget != NULL ) {
+        // Other channels of the budget may be notified too
+        dimmer_budget_t* budget = dimmer->budget->budget;
+        taskENTER_CRITICAL(&budget->lock);
+        uint32_t priorities = budget_request(dimmer->budget, dutty);
+        taskEXIT_CRITICAL(&budget->lock);
+        budget_send(budget, dimmer->budget, priorities);
+        return ESP_OK;
+    }
 
-    // Notify to queue
-    if( xTaskNotify(dimmer->task, dutty, eSetValueWithOverwrite) != pdTRUE ) {
+    if( notify_task_dimmer(dimmer, dutty) != pdTRUE ) {
         ESP_LOGW(TAG, "Failed to send notification.");
     }
     return ESP_OK;
@@ -435,39 +542,452 @@ esp_err_t set_task_dimmer_dutty( task_dimmer_t* dimmer,uint16_t dutty ) {
  * @return esp_err_t ESP_OK
 */
 esp_err_t set_task_dimmer_power( task_dimmer_t* dimmer, double power ) {
-    uint16_t dutty;
-    if( power <= 0 ) {
-        dutty = 0;
+    return set_task_dimmer_dutty(dimmer, power_to_dutty(power));
+}
+
+/**
+ * This function will return the power of the dimmer in percentage
+ * @param *dimmer a pointer to the dimmer_task the struct 
+ * @return double the power of the dimmer in percentage 0 - 1
+*/
+float get_task_dimmer_power(task_dimmer_t* dimmer) {
+    return (float) ( 0.5 * (1 - cos(M_PI * dimmer->dutty / 1000.0)));
+}
+
+/** -------------------------( Group Related )------------------------- */
+
+/**
+ * This function will initialize an empty group and register its name
+ * @param *group a pointer to the dimmer_group_t struct, must live while the group is used
+ * @param name the name of the group, must live while the group is used
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_INVALID_STATE if the name is taken
+*/
+esp_err_t create_dimmer_group( dimmer_group_t* group, const char* name ) {
+    if( group == NULL || name == NULL ) {
+        return ESP_ERR_INVALID_ARG;
     }
-    else if( power >= 1) {
-        dutty = 1000; // avoid floating point errors
+    if( find_dimmer_group(name) != NULL ) {
+        ESP_LOGE(TAG, "Group %s already exists", name);
+        return ESP_ERR_INVALID_STATE;
     }
-    else {
-        /** 
-         * Calculate dutty cycle
-         * t = acos(1 - 2 * power) / (2 * pi * freq)
-         * dutty = 1000 * t * 2 * freq
-         **/
-        dutty = (uint16_t) round(1000 * acos(1 - 2*power) / (M_PI)); // result is in ticks (0 - 1000)
+
+    group->name = name;
+    group->count = 0;
+    group->dutty = 0;
+    group->next = global_dimmer_group_list;
+    global_dimmer_group_list = group;
+    return ESP_OK;
+}
+
+/**
+ * This function will add a task dimmer to a group. Its dutty will be
+ * group dutty * scale + offset, clamped to [0 - 1000]
+ * @param *group a pointer to the dimmer_group_t struct
+ * @param *dimmer a pointer to the task_dimmer_t struct
+ * @param scale multiplier of the group dutty, in range [0 - 63.99]
+ * @param offset dutty ticks added after scaling
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM if the group is full
+*/
+esp_err_t add_dimmer_group_member( dimmer_group_t* group, task_dimmer_t* dimmer, float scale, int16_t offset ) {
+    if( group == NULL || dimmer == NULL || scale < 0 || scale >= 64 ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if( group->count >= CONFIG_DIMMER_GROUP_MAX_MEMBERS ) {
+        ESP_LOGE(TAG, "Group %s is full", group->name);
+        return ESP_ERR_NO_MEM;
     }
 
-    // update dutty
-    dimmer->dutty = dutty;
+    // Converted once here, group commands only use integer math
+    group->members[group->count] = (dimmer_group_member_t) {
+        .dimmer = dimmer,
+        .scale = (uint16_t) lroundf(scale * 1024),
+        .offset = offset,
+    };
+    group->count++;
+    return ESP_OK;
+}
 
-    dutty = 1000 - dutty; // Invert signal
+/**
+ * This function will look for a group by its name
+ * @param name the name given to create_dimmer_group()
+ * @return dimmer_group_t* the group or NULL if there is none
+*/
+dimmer_group_t* find_dimmer_group( const char* name ) {
+    for( dimmer_group_t* group = global_dimmer_group_list; group != NULL; group = group->next ) {
+        if( strcmp(group->name, name) == 0 ) {
+            return group;
+        }
+    }
+    return NULL;
+}
 
-    // Notify task
-    if( xTaskNotify(dimmer->task, dutty, eSetValueWithOverwrite) != pdTRUE ) {
-        ESP_LOGW(TAG, "Failed to send notification");
+/**
+ * This function will set the dutty cycle of every member of a group.
+ * Member values are computed first and the tasks are notified with the
+ * scheduler suspended, so they run back to back. Each comparator is updated
+ * on its own zero-crossing, members can still be one half-cycle apart.
+ * Members under a power budget get the dutty cycle the budget grants
+ * @param *group a pointer to the dimmer_group_t struct
+ * @param dutty the group dutty cycle. Must be between 0 and 1000
+ * @return esp_err_t ESP_OK
+*/
+esp_err_t set_dimmer_group_dutty( dimmer_group_t* group, uint16_t dutty ) {
+    uint16_t values[CONFIG_DIMMER_GROUP_MAX_MEMBERS];
+    uint32_t priorities[CONFIG_DIMMER_GROUP_MAX_MEMBERS];
+    uint8_t failed = 0;
+
+    if( dutty > 1000 ) {
+        dutty = 1000;
+    }
+    group->dutty = dutty;
+
+    for( uint8_t i = 0; i < group->count; i++ ) {
+        dimmer_group_member_t* member = &group->members[i];
+        int32_t value = (((int32_t) dutty * member->scale + 512) >> 10) + member->offset;
+
+        if( value < 0 ) {
+            value = 0;
+        }
+        else if( value > 1000 ) {
+            value = 1000;
+        }
+        values[i] = value;
+    }
+
+    // Grants first, each in the critical section of its budget
+    for( uint8_t i = 0; i < group->count; i++ ) {
+        dimmer_budget_channel_t* channel = group->members[i].dimmer->budget;
+
+        if( channel != NULL ) {
+            taskENTER_CRITICAL(&channel->budget->lock);
+            priorities[i] = budget_request(channel, values[i]);
+            taskEXIT_CRITICAL(&channel->budget->lock);
+        }
+    }
+
+    vTaskSuspendAll();
+    for( uint8_t i = 0; i < group->count; i++ ) {
+        task_dimmer_t* dimmer = group->members[i].dimmer;
+        BaseType_t sent;
+
+        if( dimmer->budget != NULL ) {
+            sent = budget_send(dimmer->budget->budget, dimmer->budget, priorities[i]);
+        }
+        else {
+            sent = notify_task_dimmer(dimmer, values[i]);
+        }
+        if( sent != pdTRUE ) {
+            failed++;
+        }
+    }
+    xTaskResumeAll();
+
+    if( failed ) {
+        ESP_LOGW(TAG, "Failed to send %u notifications", failed);
     }
     return ESP_OK;
 }
 
 /**
- * This function will return the power of the dimmer in percentage
- * @param *dimmer a pointer to the dimmer_task the struct 
- * @return double the power of the dimmer in percentage 0 - 1
+ * This function will set the power of a group, the dutty cycle is
+ * calculated once and applied to every member by set_dimmer_group_dutty()
+ * @param *group a pointer to the dimmer_group_t struct
+ * @param power the power to set the group to. Must be between 0 and 1
+ * @return esp_err_t ESP_OK
 */
-float get_task_dimmer_power(task_dimmer_t* dimmer) {
-    return (float) ( 0.5 * (1 - cos(M_PI * dimmer->dutty / 1000.0)));
+esp_err_t set_dimmer_group_power( dimmer_group_t* group, double power ) {
+    return set_dimmer_group_dutty(group, power_to_dutty(power));
+}
+
+/** -------------------------( Budget Related )------------------------- */
+
+#define BUDGET_ONE      32768   // scale and power fixed point 1.0
+#define BUDGET_STEP     25      // dutty ticks between two power_table entries
+
+// Power delivered at dutty 25 * i, 0.5 * (1 - cos(pi * dutty / 1000)) in fixed point
+static const uint16_t power_table[1000 / BUDGET_STEP + 1] = {
+    0, 51, 202, 453, 802, 1247, 1786, 2414,
+    3129, 3926, 4799, 5743, 6754, 7823, 8946, 10114,
+    11321, 12559, 13821, 15099, 16384, 17669, 18947, 20209,
+    21447, 22654, 23822, 24945, 26014, 27025, 27969, 28842,
+    29639, 30354, 30982, 31521, 31966, 32315, 32566, 32717,
+    32768,
+};
+
+/**
+ * This function will convert a dutty cycle into power without floating point,
+ * interpolating power_table
+ * @param dutty the dutty cycle 0 - 1000
+ * @return uint32_t the power, fixed point 32768 = 1.0
+*/
+static uint32_t dutty_to_power_fixed( uint16_t dutty ) {
+    uint16_t i = dutty / BUDGET_STEP;
+    uint16_t rest = dutty % BUDGET_STEP;
+
+    if( rest == 0 ) {
+        return power_table[i];
+    }
+    return power_table[i] + ((power_table[i + 1] - power_table[i]) * rest + BUDGET_STEP / 2) / BUDGET_STEP;
+}
+
+/**
+ * This function will convert a power into a dutty cycle without floating point,
+ * the inverse of dutty_to_power_fixed()
+ * @param power the power, fixed point 32768 = 1.0
+ * @return uint16_t the dutty cycle 0 - 1000
+*/
+static uint16_t power_fixed_to_dutty( uint32_t power ) {
+    uint16_t low = 0;
+    uint16_t high = 1000 / BUDGET_STEP;
+
+    if( power >= BUDGET_ONE ) {
+        return 1000;
+    }
+
+    // Last entry not above power
+    while( high - low > 1 ) {
+        uint16_t middle = (low + high) / 2;
+        if( power_table[middle] <= power ) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    // Rounded down, a granted dutty cycle never delivers more than its power
+    uint32_t span = power_table[high] - power_table[low];
+    return low * BUDGET_STEP + ((power - power_table[low]) * BUDGET_STEP) / span;
+}
+
+/**
+ * This function will return the dutty cycle a channel gets from its budget
+ * @param *budget a pointer to the dimmer_budget_t struct
+ * @param *channel a pointer to a channel of the budget
+ * @return uint16_t the granted dutty cycle 0 - 1000
+*/
+static uint16_t budget_granted( const dimmer_budget_t* budget, const dimmer_budget_channel_t* channel ) {
+    uint16_t scale = budget->scale[channel->priority];
+
+    if( scale >= BUDGET_ONE ) {
+        return channel->requested; // exact, no conversion
+    }
+    return power_fixed_to_dutty((dutty_to_power_fixed(channel->requested) * scale) >> 15);
+}
+
+/**
+ * This function will store the dutty cycle a channel gets from its budget,
+ * bumping its version when it changes. Call inside the critical section of the budget
+ * @param *budget a pointer to the dimmer_budget_t struct
+ * @param *channel a pointer to a channel of the budget
+ * @return void
+*/
+static void budget_grant( const dimmer_budget_t* budget, dimmer_budget_channel_t* channel ) {
+    uint16_t granted = budget_granted(budget, channel);
+
+    if( granted != channel->granted ) {
+        channel->granted = granted;
+        channel->version++;
+    }
+}
+
+/**
+ * This function will share the cap between priorities, each one gets what is
+ * left by the ones before it. Only the channels of priorities whose scale
+ * changed get a new grant, a level change under the cap touches no other channel.
+ * Call inside the critical section of the budget, both cores can set levels,
+ * and send the grants with budget_send() once it is left
+ * @param *budget a pointer to the dimmer_budget_t struct
+ * @return uint32_t bit mask of the priorities whose scale changed
+*/
+static uint32_t budget_update( dimmer_budget_t* budget ) {
+    uint32_t changed = 0;
+    uint64_t remaining = (uint64_t) budget->cap << 8;
+    uint64_t load = 0;
+
+    for( uint8_t priority = 0; priority < CONFIG_DIMMER_BUDGET_PRIORITIES; priority++ ) {
+        uint32_t requested = budget->requested[priority];
+        uint16_t scale = BUDGET_ONE;
+
+        if( requested > remaining ) {
+            scale = (uint16_t) ((remaining * BUDGET_ONE) / requested);
+            remaining = 0;
+        }
+        else {
+            remaining -= requested;
+        }
+        load += ((uint64_t) requested * scale) >> 15;
+
+        if( scale == budget->scale[priority] ) {
+            continue;
+        }
+        budget->scale[priority] = scale;
+        changed |= 1UL << priority;
+        for( dimmer_budget_channel_t* channel = budget->channels[priority]; channel != NULL; channel = channel->next ) {
+            budget_grant(budget, channel);
+        }
+    }
+    budget->load = (uint32_t) ((load + 128) >> 8);
+    return changed;
+}
+
+/**
+ * This function will notify a channel of the dutty cycle its budget grants,
+ * out of the critical section. A grant changed while sending is sent again, so
+ * the task ends on the latest one whatever the order of concurrent senders
+ * @param *channel a pointer to the dimmer_budget_channel_t struct
+ * @return BaseType_t result of the last notification
+*/
+static BaseType_t budget_notify( dimmer_budget_channel_t* channel ) {
+    dimmer_budget_t* budget = channel->budget;
+    BaseType_t sent;
+    uint16_t granted;
+    uint32_t version;
+    bool again;
+
+    taskENTER_CRITICAL(&budget->lock);
+    granted = channel->granted;
+    version = channel->version;
+    taskEXIT_CRITICAL(&budget->lock);
+
+    do {
+        sent = notify_task_dimmer(channel->dimmer, granted);
+
+        taskENTER_CRITICAL(&budget->lock);
+        again = channel->version != version;
+        granted = channel->granted;
+        version = channel->version;
+        taskEXIT_CRITICAL(&budget->lock);
+    } while( again );
+    return sent;
+}
+
+/**
+ * This function will send the grants computed by budget_request() or
+ * budget_update() after the critical section is left: the requesting channel
+ * first, then every channel of the priorities whose scale changed
+ * @param *budget a pointer to the dimmer_budget_t struct
+ * @param *changed the requesting channel, NULL for none
+ * @param priorities bit mask returned by budget_request() or budget_update()
+ * @return BaseType_t result of the notification of changed, pdTRUE without it
+*/
+static BaseType_t budget_send( dimmer_budget_t* budget, dimmer_budget_channel_t* changed, uint32_t priorities ) {
+    BaseType_t sent = pdTRUE;
+
+    if( changed != NULL ) {
+        sent = budget_notify(changed);
+    }
+    for( uint8_t priority = 0; priority < CONFIG_DIMMER_BUDGET_PRIORITIES; priority++ ) {
+        if( (priorities & (1UL << priority)) == 0 ) {
+            continue;
+        }
+        // Channels are only pushed at the head, in the critical section, and never removed
+        for( dimmer_budget_channel_t* channel = budget->channels[priority]; channel != NULL; channel = channel->next ) {
+            if( channel != changed ) {
+                budget_notify(channel);
+            }
+        }
+    }
+    return sent;
+}
+
+/**
+ * This function will record the dutty cycle asked for a channel and update
+ * its budget in O(priorities). Call inside the critical section of the budget
+ * and send the grants with budget_send() once it is left
+ * @param *channel a pointer to the dimmer_budget_channel_t struct
+ * @param dutty the requested dutty cycle 0 - 1000
+ * @return uint32_t bit mask of the priorities whose scale changed
+*/
+static uint32_t budget_request( dimmer_budget_channel_t* channel, uint16_t dutty ) {
+    dimmer_budget_t* budget = channel->budget;
+    uint32_t load = (channel->watts * dutty_to_power_fixed(dutty) + 64) >> 7;
+
+    budget->requested[channel->priority] += load - channel->load;
+    channel->load = load;
+    channel->requested = dutty;
+    uint32_t changed = budget_update(budget);
+    budget_grant(budget, channel);
+    return changed;
+}
+
+/**
+ * This function will initialize an empty power budget
+ * @param *budget a pointer to the dimmer_budget_t struct, must live while the budget is used
+ * @param cap the max estimated load of all channels in watts
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG
+*/
+esp_err_t create_dimmer_budget( dimmer_budget_t* budget, uint32_t cap ) {
+    if( budget == NULL || cap > UINT32_MAX >> 8 ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(budget, 0, sizeof(*budget));
+    portMUX_INITIALIZE(&budget->lock);
+    budget->cap = cap;
+    for( uint8_t priority = 0; priority < CONFIG_DIMMER_BUDGET_PRIORITIES; priority++ ) {
+        budget->scale[priority] = BUDGET_ONE;
+    }
+    return ESP_OK;
+}
+
+/**
+ * This function will put a task dimmer under a budget. From now on its set
+ * functions and groups request a dutty cycle and the dimmer gets what the
+ * budget grants, its current dutty cycle is the first request
+ * @param *budget a pointer to the dimmer_budget_t struct
+ * @param *channel a pointer to the dimmer_budget_channel_t struct, must live while the budget is used
+ * @param *dimmer a pointer to the task_dimmer_t struct, not under another budget
+ * @param watts the nominal load of the channel at full power
+ * @param priority 0 is served first, lower than CONFIG_DIMMER_BUDGET_PRIORITIES
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_INVALID_STATE if the dimmer has a budget
+*/
+esp_err_t add_dimmer_budget_channel( dimmer_budget_t* budget, dimmer_budget_channel_t* channel, task_dimmer_t* dimmer, uint16_t watts, uint8_t priority ) {
+    if( budget == NULL || channel == NULL || dimmer == NULL || priority >= CONFIG_DIMMER_BUDGET_PRIORITIES ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if( dimmer->budget != NULL ) {
+        ESP_LOGE(TAG, "Dimmer on GPIO %u already has a budget", dimmer->gen_gpio);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    *channel = (dimmer_budget_channel_t) {
+        .dimmer = dimmer,
+        .budget = budget,
+        .watts = watts,
+        .priority = priority,
+        .requested = 0,
+        .load = 0,
+        .granted = 0,
+        .version = 0,
+    };
+
+    taskENTER_CRITICAL(&budget->lock);
+    channel->next = budget->channels[priority];
+    budget->channels[priority] = channel;
+    dimmer->budget = channel;
+    uint32_t priorities = budget_request(channel, dimmer->dutty);
+    taskEXIT_CRITICAL(&budget->lock);
+    budget_send(budget, channel, priorities);
+    return ESP_OK;
+}
+
+/**
+ * This function will change the cap of a budget and notify the channels
+ * whose granted dutty cycle changes
+ * @param *budget a pointer to the dimmer_budget_t struct
+ * @param cap the max estimated load of all channels in watts
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG
+*/
+esp_err_t set_dimmer_budget_cap( dimmer_budget_t* budget, uint32_t cap ) {
+    if( budget == NULL || cap > UINT32_MAX >> 8 ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&budget->lock);
+    budget->cap = cap;
+    uint32_t priorities = budget_update(budget);
+    taskEXIT_CRITICAL(&budget->lock);
+    budget_send(budget, NULL, priorities);
+    return ESP_OK;
 }
@@ -8,6 +8,13 @@
 #include "driver/gpio.h"
 #include <math.h>
 
+#if CONFIG_DIMMER_NO_HEAP
+// function that allocates from the heap, an error to call it
+#define DIMMER_HEAP_API __attribute__((error("allocates from the heap, disabled by CONFIG_DIMMER_NO_HEAP: use create_task_dimmer_static()")))
+#else
+#define DIMMER_HEAP_API
+#endif
+
 extern int8_t global_dimmer_groups[SOC_MCPWM_GROUPS];
 extern uint32_t global_dimmer_generators;
 
@@ -41,15 +48,75 @@ esp_err_t validate_generator( uint8_t gen_gpio);
 
 typedef struct task_dimmer
 {
-    uint8_t        gen_gpio;
-    uint8_t        sync_gpio;
-    uint16_t       dutty;
-    TaskHandle_t   task;
+    uint8_t                         gen_gpio;
+    uint8_t                         sync_gpio;
+    uint16_t                        dutty;
+    TaskHandle_t                    task;
+    struct dimmer_budget_channel*   budget;     // internal management
 } task_dimmer_t;
 
-task_dimmer_t create_task_dimmer( uint8_t gen_gpio, uint8_t sync_gpio );
+typedef struct task_dimmer_static
+{
+    StaticTask_t    task;                               // internal management
+    StackType_t     stack[CONFIG_DIMMER_TASK_STACK];    // internal management
+} task_dimmer_static_t;
+
+DIMMER_HEAP_API task_dimmer_t create_task_dimmer( uint8_t gen_gpio, uint8_t sync_gpio );
+esp_err_t create_task_dimmer_static( task_dimmer_t* dimmer, uint8_t gen_gpio, uint8_t sync_gpio, task_dimmer_static_t* buffers );
 esp_err_t delete_task_dimmer( task_dimmer_t* dimmer );
 esp_err_t set_task_dimmer_dutty( task_dimmer_t* dimmer, uint16_t dutty );
 esp_err_t set_task_dimmer_power( task_dimmer_t* dimmer, double power );
 float get_task_dimmer_power(task_dimmer_t* dimmer);
 
+/** -------------------------( Group Related )------------------------- */
+
+typedef struct dimmer_group_member
+{
+    task_dimmer_t* dimmer;  // channel moved by the group
+    uint16_t       scale;   // multiplier of the group dutty, fixed point 1024 = 1.0
+    int16_t        offset;  // dutty ticks added after scaling
+} dimmer_group_member_t;
+
+typedef struct dimmer_group
+{
+    const char*             name;                                       // group name
+    dimmer_group_member_t   members[CONFIG_DIMMER_GROUP_MAX_MEMBERS];   // internal management
+    uint8_t                 count;                                      // number of members
+    uint16_t                dutty;                                      // group dutty cycle 0-1000
+    struct dimmer_group*    next;                                       // internal management
+} dimmer_group_t;
+
+esp_err_t create_dimmer_group( dimmer_group_t* group, const char* name );
+esp_err_t add_dimmer_group_member( dimmer_group_t* group, task_dimmer_t* dimmer, float scale, int16_t offset );
+dimmer_group_t* find_dimmer_group( const char* name );
+esp_err_t set_dimmer_group_dutty( dimmer_group_t* group, uint16_t dutty );
+esp_err_t set_dimmer_group_power( dimmer_group_t* group, double power );
+
+/** -------------------------( Budget Related )------------------------- */
+
+typedef struct dimmer_budget_channel
+{
+    task_dimmer_t*                  dimmer;     // channel under the budget
+    struct dimmer_budget*           budget;     // internal management
+    uint16_t                        watts;      // nominal load at full power
+    uint8_t                         priority;   // 0 is served first
+    uint16_t                        requested;  // dutty cycle asked for 0-1000
+    uint32_t                        load;       // internal management, requested load in 1/256 W
+    uint16_t                        granted;    // internal management, dutty cycle the budget grants
+    uint32_t                        version;    // internal management, bumped when granted changes
+    struct dimmer_budget_channel*   next;       // internal management
+} dimmer_budget_channel_t;
+
+typedef struct dimmer_budget
+{
+    uint32_t                    cap;                                        // max estimated load in watts
+    uint32_t                    load;                                       // estimated load in watts after scaling
+    uint32_t                    requested[CONFIG_DIMMER_BUDGET_PRIORITIES]; // internal management, load per priority in 1/256 W
+    uint16_t                    scale[CONFIG_DIMMER_BUDGET_PRIORITIES];     // granted part of each priority, fixed point 32768 = 1.0
+    dimmer_budget_channel_t*    channels[CONFIG_DIMMER_BUDGET_PRIORITIES];  // internal management
+    portMUX_TYPE                lock;                                       // internal management
+} dimmer_budget_t;
+
+esp_err_t create_dimmer_budget( dimmer_budget_t* budget, uint32_t cap );
+esp_err_t add_dimmer_budget_channel( dimmer_budget_t* budget, dimmer_budget_channel_t* channel, task_dimmer_t* dimmer, uint16_t watts, uint8_t priority );
+esp_err_t set_dimmer_budget_cap( dimmer_budget_t* budget, uint32_t cap );
@@ -0,0 +1,66 @@
+/**
+ * @file menu_dimmer.h
+ * @brief Menu panel built from the registered dimmers: an editable level
+ * and live power and mains readouts for every channel.
+ */
+
+#ifndef __MENU_DIMMER_H__
+#define __MENU_DIMMER_H__
+#pragma once
+#include "dimmer.h"
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Register a dimmer driven with set_dutty().
+ *
+ * @param label Label of its submenu, must live while the panel exists.
+ * @param dimmer Dimmer created with create_dimmer(), must live as long.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE after
+ * menu_dimmer_panel_init() or ESP_ERR_NO_MEM above
+ * CONFIG_MENU_DIMMER_MAX_CHANNELS.
+ */
+esp_err_t menu_dimmer_add(const char *label, dimmer_t *dimmer);
+
+/**
+ * @brief Register a dimmer driven by its task with set_task_dimmer_dutty().
+ *
+ * @param label Label of its submenu, must live while the panel exists.
+ * @param dimmer Dimmer returned by create_task_dimmer() or initialized by
+ * create_task_dimmer_static(), must live as long.
+ * @return Same as menu_dimmer_add().
+ */
+esp_err_t menu_dimmer_add_task(const char *label, task_dimmer_t *dimmer);
+
+/**
+ * @brief Turn node into the panel: one submenu per registered dimmer with
+ * its level in percent, editable, and read only power and mains frequency.
+ * A timer reads the dimmers every CONFIG_MENU_DIMMER_REFRESH_MS and posts
+ * NAVIGATE_REFRESH only when a value shown by the menu changed. Levels
+ * follow changes made outside the menu unless they are being edited.
+ *
+ * Call it before the menu is created, the panel only works in menu_node_t
+ * trees.
+ *
+ * @param node Node of the menu tree, its label is kept.
+ * @param ctx Menu instance showing the node, NULL for the default one.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE when called
+ * twice or the error of the timer.
+ */
+esp_err_t menu_dimmer_panel_init(menu_node_t *node, menu_ctx_t *ctx);
+
+/**
+ * @brief Stop the readout timer. The node keeps the last values.
+ */
+void menu_dimmer_panel_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_DIMMER_H__
@@ -0,0 +1,252 @@
+#include "menu_dimmer.h"
+#include "dimmer.h"
+#include "esp_err.h"
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/timers.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+const static char *TAG = "menu_dimmer";
+
+#define OPTIONS 3
+#define MAX_DUTY 1000
+
+#ifdef CONFIG_FREQUENCY_50HZ
+#define MAINS_DECIHERTZ 500
+#else
+#define MAINS_DECIHERTZ 600
+#endif
+
+typedef struct {
+  dimmer_t *dimmer;
+  task_dimmer_t *task_dimmer;
+  int32_t level;
+  int32_t power;
+  int32_t mains;
+  uint16_t posted; // duty last refreshed, timer only
+  menu_value_t level_value;
+  menu_value_t power_value;
+  menu_value_t mains_value;
+  menu_node_t options[OPTIONS];
+} channel_t;
+
+static channel_t channels[CONFIG_MENU_DIMMER_MAX_CHANNELS];
+static menu_node_t nodes[CONFIG_MENU_DIMMER_MAX_CHANNELS];
+static size_t num_channels;
+static menu_ctx_t *panel_ctx;
+#if CONFIG_MENU_NO_HEAP
+// esp_timer allocates its timers, a FreeRTOS timer lives here.
+static TimerHandle_t refresh;
+static StaticTimer_t refresh_buffer;
+#else
+static esp_timer_handle_t refresh;
+#endif
+
+static uint16_t Duty(const channel_t *channel) {
+  return channel->dimmer ? channel->dimmer->dutty
+                         : channel->task_dimmer->dutty;
+}
+
+// Power delivered by a phase cut at duty, in tenths of percent. Same curve
+// as get_power().
+static int32_t Power(uint16_t duty) {
+  return lroundf(500.0f * (1.0f - cosf((float)M_PI * duty / MAX_DUTY)));
+}
+
+static void LevelChanged(menu_value_t *value, void *arg) {
+  channel_t *channel = (channel_t *)arg;
+
+  // Both only store the compare value or notify the dimmer task.
+  if (channel->dimmer)
+    set_dutty(channel->dimmer, channel->level);
+  else
+    set_task_dimmer_dutty(channel->task_dimmer, channel->level);
+  channel->power = Power(channel->level);
+}
+
+// Both refresh callbacks run in the menu task, which owns level and power.
+static void LevelRefresh(menu_value_t *value, void *arg) {
+  channel_t *channel = (channel_t *)arg;
+
+  channel->level = Duty(channel);
+}
+
+static void PowerRefresh(menu_value_t *value, void *arg) {
+  channel_t *channel = (channel_t *)arg;
+
+  channel->power = Power(Duty(channel));
+}
+
+static esp_err_t Add(const char *label, dimmer_t *dimmer,
+                     task_dimmer_t *task_dimmer) {
+  if (!label)
+    return ESP_ERR_INVALID_ARG;
+  if (refresh)
+    return ESP_ERR_INVALID_STATE;
+  if (num_channels == CONFIG_MENU_DIMMER_MAX_CHANNELS) {
+    ESP_LOGE(TAG, "No room for %s, raise MENU_DIMMER_MAX_CHANNELS", label);
+    return ESP_ERR_NO_MEM;
+  }
+
+  channel_t *channel = &channels[num_channels];
+  *channel = (channel_t){
+      .dimmer = dimmer,
+      .task_dimmer = task_dimmer,
+  };
+  channel->level = Duty(channel);
+  channel->power = Power(channel->level);
+  channel->posted = channel->level;
+  channel->mains = dimmer ? lroundf(dimmer->heartz * 10) : MAINS_DECIHERTZ;
+
+  channel->level_value = (menu_value_t){
+      .type = MENU_VALUE_FIXED,
+      .number = &channel->level,
+      .min = 0,
+      .max = MAX_DUTY,
+      .step = 10,
+      .decimals = 1,
+      .on_change = LevelChanged,
+      .refresh = LevelRefresh,
+      .arg = channel,
+  };
+  channel->power_value = (menu_value_t){
+      .type = MENU_VALUE_FIXED,
+      .number = &channel->power,
+      .max = MAX_DUTY,
+      .decimals = 1,
+      .read_only = true,
+      .refresh = PowerRefresh,
+      .arg = channel,
+  };
+  channel->mains_value = (menu_value_t){
+      .type = MENU_VALUE_FIXED,
+      .number = &channel->mains,
+      .max = INT32_MAX,
+      .decimals = 1,
+      .read_only = true,
+  };
+  channel->options[0] = (menu_node_t){.label = "Level %",
+                                      .value = &channel->level_value};
+  channel->options[1] = (menu_node_t){.label = "Power %",
+                                      .value = &channel->power_value};
+  channel->options[2] = (menu_node_t){.label = "Mains Hz",
+                                      .value = &channel->mains_value};
+  nodes[num_channels] = (menu_node_t){
+      .label = (char *)label,
+      .submenus = channel->options,
+      .num_options = OPTIONS,
+  };
+  num_channels++;
+  return ESP_OK;
+}
+
+// Runs in the esp_timer task: plain reads of the dimmers and a queue send
+// that never waits, neither side can be blocked by the other. The menu task
+// writes the values itself on NAVIGATE_REFRESH, the timer only tells it when
+// the channel it shows has a new duty.
+static void Refresh(void *args) {
+  menu_ctx_t *ctx = panel_ctx ? panel_ctx : menu_default_ctx();
+
+  if (!ctx)
+    return;
+
+  menu_node_t *shown =
+      __atomic_load_n(&ctx->path.current_menu, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < num_channels; i++) {
+    channel_t *channel = &channels[i];
+    uint16_t duty = Duty(channel);
+
+    // A duty changed while another menu was shown is posted once the
+    // channel is shown. A full queue is retried on the next tick.
+    if (shown == &nodes[i] && duty != channel->posted &&
+        menu_ctx_send(ctx, NAVIGATE_REFRESH, 0) == ESP_OK)
+      channel->posted = duty;
+  }
+}
+
+esp_err_t menu_dimmer_add(const char *label, dimmer_t *dimmer) {
+  if (!dimmer)
+    return ESP_ERR_INVALID_ARG;
+  return Add(label, dimmer, NULL);
+}
+
+esp_err_t menu_dimmer_add_task(const char *label, task_dimmer_t *dimmer) {
+  if (!dimmer)
+    return ESP_ERR_INVALID_ARG;
+  return Add(label, NULL, dimmer);
+}
+
+#if CONFIG_MENU_NO_HEAP
+static void RefreshTimer(TimerHandle_t timer) { Refresh(NULL); }
+
+static esp_err_t StartRefresh(void) {
+  refresh = xTimerCreateStatic(
+      "menu_dimmer", pdMS_TO_TICKS(CONFIG_MENU_DIMMER_REFRESH_MS), pdTRUE,
+      NULL, RefreshTimer, &refresh_buffer);
+  if (xTimerStart(refresh, portMAX_DELAY) != pdPASS)
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+static void StopRefresh(void) { xTimerDelete(refresh, portMAX_DELAY); }
+#else
+static esp_err_t StartRefresh(void) {
+  esp_timer_create_args_t args = {
+      .callback = Refresh,
+      .name = "menu_dimmer",
+  };
+  esp_err_t err = esp_timer_create(&args, &refresh);
+
+  if (err == ESP_OK) {
+    err = esp_timer_start_periodic(refresh,
+                                   CONFIG_MENU_DIMMER_REFRESH_MS * 1000ULL);
+  }
+  return err;
+}
+
+static void StopRefresh(void) {
+  esp_timer_stop(refresh);
+  esp_timer_delete(refresh);
+}
+#endif
+
+esp_err_t menu_dimmer_panel_init(menu_node_t *node, menu_ctx_t *ctx) {
+  if (!node)
+    return ESP_ERR_INVALID_ARG;
+  if (refresh)
+    return ESP_ERR_INVALID_STATE;
+
+  node->submenus = nodes;
+  node->num_options = num_channels;
+  node->function = NULL;
+  node->virtual_menu = NULL;
+  node->value = NULL;
+  panel_ctx = ctx;
+
+  esp_err_t err = StartRefresh();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Readout timer: %s", esp_err_to_name(err));
+    menu_dimmer_panel_deinit();
+  }
+  return err;
+}
+
+void menu_dimmer_panel_deinit(void) {
+  if (refresh) {
+    StopRefresh();
+    refresh = NULL;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+/**
+ * @file menu_alloc.h
+ * @brief Marks the functions that allocate from the heap, so a call to one of
+ * them fails the build with CONFIG_MENU_NO_HEAP.
+ */
+
+#ifndef __MENU_ALLOC_H__
+#define __MENU_ALLOC_H__
+#pragma once
+#include "sdkconfig.h"
+
+#if CONFIG_MENU_NO_HEAP
+/** Declaration of a function that allocates, an error to call it. */
+#define MENU_HEAP_API                                                          \
+  __attribute__((error("allocates from the heap, disabled by "                \
+                       "CONFIG_MENU_NO_HEAP: use the _static function")))
+#else
+#define MENU_HEAP_API
+#endif
+
+#endif //__MENU_ALLOC_H__
@@ -0,0 +1,195 @@
+/**
+ * @file menu_hd44780.h
+ * @brief menu_renderer backend for an HD44780 behind a PCF8574 I2C expander
+ * that sends every flush as one multi-byte I2C write.
+ */
+
+#ifndef __MENU_HD44780_H__
+#define __MENU_HD44780_H__
+#pragma once
+#include "menu_alloc.h"
+#include "menu_renderer.h"
+#include "sdkconfig.h"
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Stack of the sender task with async. */
+#define MENU_HD44780_TASK_STACK 2048
+
+/**
+ * PCF8574 port bit of every HD44780 line.
+ *
+ */
+typedef struct {
+  uint8_t rs;
+  /**< Register select. */
+  uint8_t e;
+  /**< Enable strobe. */
+  uint8_t d4;
+  /**< Data bit 4. */
+  uint8_t d5;
+  /**< Data bit 5. */
+  uint8_t d6;
+  /**< Data bit 6. */
+  uint8_t d7;
+  /**< Data bit 7. */
+  uint8_t bl;
+  /**< Backlight. */
+} menu_hd44780_pins_t;
+
+/**
+ * Display settings.
+ *
+ */
+typedef struct {
+  esp_err_t (*bus_write)(void *arg, const uint8_t *data, size_t len);
+  /**< Write len bytes to the PCF8574 in one I2C transaction. */
+  void *arg;
+  /**< User pointer passed to bus_write. */
+  menu_hd44780_pins_t pins;
+  /**< Wiring of the expander. */
+  uint8_t cols;
+  /**< Characters per row, sets the address of rows 2 and 3. */
+  uint8_t rows;
+  /**< Rows of the display. */
+  bool backlight;
+  /**< Backlight on at start. */
+  bool async;
+  /**< Send from a task, flush returns while the bus is busy. */
+} menu_hd44780_config_t;
+
+/**
+ * Memory of a display initialized with menu_hd44780_init_static(), must live
+ * while the display is used. Everything is internal management.
+ *
+ */
+typedef struct {
+  uint8_t buffers[2][CONFIG_MENU_HD44780_BUFFER_SIZE];
+  /**< Port bytes, the second one only with async. */
+  StaticSemaphore_t idle;
+  /**< internal management */
+  StaticTask_t task;
+  /**< Sender task with async. */
+  StackType_t stack[MENU_HD44780_TASK_STACK];
+  /**< Stack of the sender task. */
+} menu_hd44780_static_t;
+
+/**
+ * Display instance. Fields are internal management except the counters.
+ *
+ */
+typedef struct {
+  menu_hd44780_config_t config;
+  /**< Copy of settings. */
+  uint8_t *buffers[2];
+  /**< Port bytes being encoded and being sent. */
+  menu_hd44780_static_t *storage;
+  /**< Memory of menu_hd44780_init_static(), NULL when allocated. */
+  size_t len[2];
+  /**< Bytes in each buffer. */
+  uint8_t fill;
+  /**< Buffer being encoded. */
+  uint8_t port;
+  /**< Last byte written to the expander. */
+  uint8_t backlight;
+  /**< Backlight bit of every byte. */
+  TaskHandle_t task;
+  /**< Sender task with async. */
+  SemaphoreHandle_t idle;
+  /**< Given while the sender task is not sending. */
+  volatile esp_err_t error;
+  /**< First error of the sender task not returned yet. */
+  uint32_t transactions;
+  /**< I2C writes sent. */
+  uint32_t bytes;
+  /**< Port bytes sent, without the address byte of each write. */
+} menu_hd44780_t;
+
+/**
+ * @brief Initialize the display in 4 bit mode and clear it. Blocks about
+ * 60 ms for the power on delays of the controller.
+ *
+ * @param lcd Instance to initialize.
+ * @param config Settings, copied.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_NO_MEM or an error of
+ * bus_write.
+ */
+MENU_HEAP_API esp_err_t menu_hd44780_init(menu_hd44780_t *lcd,
+                                          const menu_hd44780_config_t *config);
+
+/**
+ * @brief menu_hd44780_init() with buffers and sender task in caller memory.
+ *
+ * @param lcd Instance to initialize.
+ * @param config Settings, copied.
+ * @param storage Memory of the display, must live while it is used.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or an error of bus_write.
+ */
+esp_err_t menu_hd44780_init_static(menu_hd44780_t *lcd,
+                                   const menu_hd44780_config_t *config,
+                                   menu_hd44780_static_t *storage);
+
+/**
+ * @brief Wait for the last send, stop the sender task and free buffers, the
+ * storage of menu_hd44780_init_static() is left to the caller.
+ *
+ * @param lcd Display.
+ */
+void menu_hd44780_deinit(menu_hd44780_t *lcd);
+
+/**
+ * @brief Backend for menu_renderer_init(). Glyph uploads, cursor moves and
+ * characters are encoded into a buffer, menu_renderer_flush() sends it in
+ * one write.
+ *
+ * @param lcd Display.
+ * @param backend Output.
+ */
+void menu_hd44780_backend(menu_hd44780_t *lcd,
+                          menu_renderer_backend_t *backend);
+
+/**
+ * @brief Switch the backlight, with the next flush when something is
+ * buffered or right away. Call from the task that flushes the renderer.
+ *
+ * @param lcd Display.
+ * @param on Backlight on.
+ * @return ESP_OK or an error of bus_write.
+ */
+esp_err_t menu_hd44780_set_backlight(menu_hd44780_t *lcd, bool on);
+
+/**
+ * @brief Write a 5x8 glyph into a CGRAM slot. The cursor position is lost,
+ * call menu_renderer_invalidate() if the renderer is not doing it. Call from
+ * the task that flushes the renderer.
+ *
+ * @param lcd Display.
+ * @param slot CGRAM slot 0-7, shown by characters slot and slot + 8.
+ * @param bitmap 8 rows of 5 bits.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or an error of bus_write.
+ */
+esp_err_t menu_hd44780_upload_glyph(menu_hd44780_t *lcd, uint8_t slot,
+                                    const uint8_t bitmap[8]);
+
+/**
+ * @brief Send what is buffered and wait until the bus is idle.
+ *
+ * @param lcd Display.
+ * @return ESP_OK or an error of bus_write.
+ */
+esp_err_t menu_hd44780_sync(menu_hd44780_t *lcd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_HD44780_H__
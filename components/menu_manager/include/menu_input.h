@@ -0,0 +1,134 @@
+/**
+ * @file menu_input.h
+ * @brief GPIO buttons and quadrature encoders that post Navigate_t to a menu
+ * straight from their interrupts.
+ */
+
+#ifndef __MENU_INPUT_H__
+#define __MENU_INPUT_H__
+#pragma once
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <driver/gpio.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Push button. Set the fields before menu_input_button_add(), the rest is
+ * internal management.
+ *
+ */
+typedef struct {
+  gpio_num_t gpio;
+  /**< Button pin, the internal pull resistor is enabled. */
+  bool active_high;
+  /**< Pressed reads 1, wired to VCC. False for a button to GND. */
+  Navigate_t command;
+  /**< Posted on release, or on press without long_command. */
+  Navigate_t long_command;
+  /**< Posted once the button is held long_press_ms, NAVIGATE_NOTHING for
+   * none. */
+  uint32_t long_press_ms;
+  /**< Hold time of long_command, 0 for CONFIG_MENU_INPUT_LONG_PRESS_MS. */
+  menu_ctx_t *ctx;
+  /**< internal management */
+#if CONFIG_MENU_NO_HEAP
+  TimerHandle_t debounce;
+  /**< internal management */
+  TimerHandle_t long_press;
+  /**< internal management */
+  StaticTimer_t debounce_buffer;
+  /**< internal management */
+  StaticTimer_t long_press_buffer;
+  /**< internal management */
+#else
+  esp_timer_handle_t debounce;
+  /**< internal management */
+  esp_timer_handle_t long_press;
+  /**< internal management */
+#endif
+  volatile bool pressed;
+  /**< internal management */
+  volatile bool long_sent;
+  /**< internal management */
+  volatile uint32_t dropped;
+  /**< Commands lost because the menu queue was full or not created. */
+} menu_input_button_t;
+
+/**
+ * Quadrature rotary encoder. Set the fields before menu_input_encoder_add(),
+ * the rest is internal management.
+ *
+ */
+typedef struct {
+  gpio_num_t pin_a;
+  /**< Channel A, CLK. */
+  gpio_num_t pin_b;
+  /**< Channel B, DT. */
+  uint8_t steps;
+  /**< Quadrature steps per detent, 0 for 4. */
+  bool reverse;
+  /**< Post NAVIGATE_DOWN for clockwise instead of NAVIGATE_UP. */
+  menu_ctx_t *ctx;
+  /**< internal management */
+  volatile uint8_t state;
+  /**< internal management */
+  volatile int8_t count;
+  /**< internal management */
+  volatile uint32_t dropped;
+  /**< Commands lost because the menu queue was full or not created. */
+} menu_input_encoder_t;
+
+/**
+ * @brief Start posting the commands of a button. The pin is debounced for
+ * CONFIG_MENU_INPUT_DEBOUNCE_MS by a one shot timer started from the GPIO
+ * interrupt. With CONFIG_MENU_NO_HEAP the timers are FreeRTOS timers inside
+ * button, run by the timer service task.
+ *
+ * @param button Button, must live while it is added.
+ * @param ctx Menu instance, NULL for the default one. Commands before its
+ * queue exists are dropped.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or the error of the GPIO or timer
+ * driver.
+ */
+esp_err_t menu_input_button_add(menu_input_button_t *button, menu_ctx_t *ctx);
+
+/**
+ * @brief Stop a button and delete its timers.
+ *
+ * @param button Button added with menu_input_button_add().
+ */
+void menu_input_button_remove(menu_input_button_t *button);
+
+/**
+ * @brief Start posting NAVIGATE_UP/NAVIGATE_DOWN for every detent of an
+ * encoder. Both pins interrupt on every edge and a transition table drops
+ * the steps of contact bounce.
+ *
+ * @param encoder Encoder, must live while it is added.
+ * @param ctx Menu instance, NULL for the default one.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or the error of the GPIO driver.
+ */
+esp_err_t menu_input_encoder_add(menu_input_encoder_t *encoder,
+                                 menu_ctx_t *ctx);
+
+/**
+ * @brief Stop an encoder.
+ *
+ * @param encoder Encoder added with menu_input_encoder_add().
+ */
+void menu_input_encoder_remove(menu_input_encoder_t *encoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_INPUT_H__
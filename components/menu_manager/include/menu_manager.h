@@ -7,20 +7,31 @@
 #define __MENU_MANAGER_H__
 #pragma once
 #include "freertos/idf_additions.h"
+#include "menu_alloc.h"
+#include "menu_tree.h"
 #include "sdkconfig.h"
 #include <esp_err.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
 #include <freertos/semphr.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define END_MENU_FUNCTION end_menuFunction()
+#define END_MENU_FUNCTION exitFunction()
 #define SET_QUICK_FUNCTION setQuick_menuFunction()
 
+/** Commands the queue of a menu instance holds. */
+#define MENU_COMMAND_QUEUE_LENGTH 10
+
 extern TaskHandle_t tMenuFunction;
+/** Queue of the default instance. Its items are Navigate_t, menu_command_t
+ * keeps their size. */
 extern QueueHandle_t qCommands;
 
 /**
@@ -38,11 +49,44 @@ typedef enum {
   /**< Action BACH (depth--). */
   NAVIGATE_NOTHING,
   /**< Nothing. */
+  NAVIGATE_FUNCTION_DONE,
+  /**< Posted by exitFunction() when the running function has finished. */
+  NAVIGATE_GOTO,
+  /**< Posted by menu_ctx_goto(), jump to the node it found. */
+  NAVIGATE_REFRESH,
+  /**< Reload the values of the current menu with their refresh callback and
+   * redraw, posted when a shown live value changed. Ignored while a function
+   * runs. */
 } Navigate_t;
 
+/**
+ * Item of the command queue of a menu instance. It has the size of a
+ * Navigate_t and, on the little endian targets, a Navigate_t sent as is
+ * reads as its command with no stamp and arg 0, so code sending Navigate_t
+ * to qCommands keeps working.
+ *
+ */
+typedef struct {
+  uint8_t command;
+  /**< Navigate_t command. */
+  uint8_t stamp;
+  /**< Slot + 1 of the enqueue time with CONFIG_MENU_TRACE, 0 when not
+   * stamped. See menu_trace_stamp(). */
+  uint16_t arg;
+  /**< Path index entry of NAVIGATE_GOTO, unused by other commands. */
+} menu_command_t;
+
+/** Enqueue times kept for stamped commands still in the queue. */
+#define MENU_TRACE_STAMPS 32
+
+struct menu_virtual;
+struct menu_value;
+
 /**
  * Menu System is based in nodes all menus are nodes. Submenus are nodes with
  * array of more submenus and function (leafs) are nodes with function.
+ * tools/menu_tree_gen.py reports RAM savings from its size, update
+ * MENU_NODE_T_SIZE there when adding a field.
  *
  */
 typedef struct menu_node {
@@ -54,48 +98,511 @@ typedef struct menu_node {
   /**< number of option on submenu. */
   void (*function)(void *args);
   /**< function that defined this node as leaf. */
+  struct menu_virtual *virtual_menu;
+  /**< Children generated on demand, used instead of submenus and
+   * num_options when not NULL. */
+  struct menu_value *value;
+  /**< Variable edited inside the menu, makes this node a leaf without
+   * function. */
 } menu_node_t;
 
+/**
+ * Kind of value edited by a menu_value_t.
+ *
+ */
+typedef enum {
+  MENU_VALUE_INT,
+  /**< Integer spinner on *number. */
+  MENU_VALUE_FIXED,
+  /**< Fixed-point spinner, *number in units of 10^-decimals. */
+  MENU_VALUE_TOGGLE,
+  /**< Toggle of *flag, SELECT flips it. */
+  MENU_VALUE_ENUM,
+  /**< Picker of options[*number - min], wraps around. */
+} menu_value_type_t;
+
+/**
+ * Variable edited inside the menu loop, without any task. SELECT on the node
+ * starts editing (or flips a toggle), UP/DOWN change the value by step with
+ * the encoder acceleration, SELECT or BACK stop editing.
+ *
+ */
+typedef struct menu_value {
+  menu_value_type_t type;
+  /**< Kind of value. */
+  union {
+    int32_t *number;
+    /**< Bound variable of INT, FIXED and ENUM. */
+    bool *flag;
+    /**< Bound variable of TOGGLE. */
+  };
+  int32_t min;
+  /**< Minimum value. */
+  int32_t max;
+  /**< Maximum value. */
+  int32_t step;
+  /**< Change per UP/DOWN, 0 means 1. */
+  uint8_t decimals;
+  /**< Decimal places of FIXED. */
+  const char *const *options;
+  /**< Labels of ENUM, max - min + 1 entries. */
+  bool read_only;
+  /**< Live readout, shown like its type but SELECT does nothing. */
+  void (*on_change)(struct menu_value *value, void *arg);
+  /**< Called from the menu task after every change or NULL. */
+  void (*refresh)(struct menu_value *value, void *arg);
+  /**< Called from the menu task on NAVIGATE_REFRESH to reload the bound
+   * variable, unless it is being edited, or NULL. Only for options of a
+   * menu_node_t menu that is not virtual. */
+  void *arg;
+  /**< User pointer passed to on_change and refresh. */
+  uint32_t min_interval_ms;
+  /**< Min time between two on_change calls, 0 for no limit. The last value
+   * is always delivered. */
+  int64_t last_change;
+  /**< internal management */
+  bool pending;
+  /**< internal management */
+} menu_value_t;
+
+/**
+ * One cached child of a virtual node.
+ *
+ */
+typedef struct {
+  menu_node_t node;
+  /**< Child filled by get_child. */
+  char label[CONFIG_MENU_VIRTUAL_LABEL_SIZE];
+  /**< Buffer for label of node. */
+  size_t index;
+  /**< Index of child. */
+  const struct menu_virtual *menu;
+  /**< Virtual node of the child, NULL when the entry is empty. */
+  uint32_t generation;
+  /**< Generation of menu the child was built in. */
+  uint32_t used;
+  /**< Lookup order in the cache, 0 when never used. */
+} menu_virtual_entry_t;
+
+/**
+ * Virtual node: children are built only when they are shown or selected and
+ * kept in a cache of CONFIG_MENU_VIRTUAL_CACHE_SIZE entries of the menu
+ * instance showing them, slot chosen by index, so a list of thousands of
+ * entries uses constant memory. Several instances can show the same node,
+ * each one builds its own children. A function of a child can read the
+ * selected index from current_index of its menu.
+ *
+ */
+typedef struct menu_virtual {
+  size_t (*count)(void *arg);
+  /**< Number of children. Only the first 65535 of a longer list are
+   * shown. */
+  void (*get_child)(void *arg, size_t index, menu_node_t *child, char *label,
+                    size_t label_size);
+  /**< Fill child at index. Label can be written in label buffer, child->label
+   * already points to it, or child->label can point to a constant string.
+   * With CONFIG_MENU_RENDER_TASK the render task calls it too. */
+  void *arg;
+  /**< User pointer passed to callbacks. */
+  uint32_t generation;
+  /**< internal management */
+} menu_virtual_t;
+
 /**
  * Struct for save location and index.
  *
  */
 typedef struct {
   menu_node_t *current_menu;
-  /**< Point if current menu. */
-  uint8_t current_index;
+  /**< Point if current menu, NULL with flash tree. */
+  uint16_t current_index;
   /**< current Index of selected option. */
+  uint16_t current_node;
+  /**< Current node of flash tree. */
+  const menu_tree_t *tree;
+  /**< Flash tree or NULL with menu_node_t tree. */
+  bool editing;
+  /**< Selected option is a value being edited. */
+  menu_virtual_entry_t *cache;
+  /**< Children of virtual nodes built for this path, owned by its menu
+   * instance. */
 } menu_path_t;
 
+/**
+ * Open level kept on the path stack while a submenu below it is shown.
+ *
+ */
+typedef struct {
+  uint16_t node;
+  /**< Node of the level in a flash tree. Unused with menu_node_t trees,
+   * whose levels are found again from root through the selected indexes. */
+  uint16_t index;
+  /**< Selected option, the submenu opened below. */
+  uint16_t check;
+  /**< Label check of that option with menu_node_t trees, BACK stops at the
+   * first level whose option changed since, as a virtual list can. */
+} menu_path_entry_t;
+
 /**
  * This struct is all essential args that menu_init will need.
  */
 typedef struct {
   menu_node_t root;
   /**< Menu_node_t: origin of Menu System. */
+  const menu_tree_t *tree;
+  /**< Flash tree from menu_tree_generate(), used instead of root when not
+   * NULL. */
   void (*display)(menu_path_t *current_path);
   /**< Function that receive menu_path_t and index for display current
    * selection. */
   bool loop;
   /**< Loop menu. */
+  const char *persist_key;
+  /**< NVS key of the saved position with CONFIG_MENU_PERSIST, up to 15
+   * characters, unique per menu. NULL to start at root. */
 } menu_config_t;
 
+/**
+ * Timestamps of one command, esp_timer_get_time() microseconds. Read them
+ * with the functions of menu_trace.h.
+ *
+ */
+typedef struct {
+  Navigate_t command;
+  /**< Command. */
+  int64_t enqueued;
+  /**< Sent with menu_ctx_send() or menu_trace_stamp(), -1 when the sender
+   * did not stamp it. */
+  int64_t dequeued;
+  /**< Received by the menu loop, 0 while no command is traced. */
+  int64_t changed;
+  /**< Menu state updated. */
+  int64_t shown;
+  /**< Display function returned, -1 when no frame showed this state: a
+   * function started or a newer state replaced it in the render task. */
+} menu_trace_record_t;
+
+/**
+ * One slot of the trace ring, written without locks.
+ *
+ */
+typedef struct {
+  volatile uint32_t seq;
+  /**< Odd while written, then twice the position + 2. */
+  menu_trace_record_t record;
+  /**< Record of the command. */
+} menu_trace_slot_t;
+
+/**
+ * Memory of a menu instance created with menu_ctx_create_static(), must live
+ * while the menu runs. Everything is internal management.
+ *
+ */
+typedef struct menu_ctx_static {
+  StaticQueue_t commands;
+  /**< Command queue. */
+  uint8_t command_storage[MENU_COMMAND_QUEUE_LENGTH * sizeof(menu_command_t)];
+  /**< Items of the command queue. */
+  StaticEventGroup_t events;
+  /**< internal management */
+  menu_path_entry_t stack[CONFIG_MAX_DEPTH_PATH - 1];
+  /**< Path stack of every level CONFIG_MAX_DEPTH_PATH allows. */
+  StaticTask_t function;
+  /**< Task of the running function, one at a time. */
+  StackType_t function_stack[CONFIG_MENU_FUNCTION_STACK];
+  /**< Stack of the running function. */
+#if CONFIG_MENU_RENDER_TASK
+  StaticTask_t render;
+  /**< Render task. */
+  StackType_t render_stack[CONFIG_MENU_RENDER_TASK_STACK];
+  /**< Stack of the render task. */
+#endif
+} menu_ctx_static_t;
+
+/**
+ * Menu instance. Each one owns its path stack, command queue, function task
+ * and display, so several menus can run at the same time. Create with
+ * menu_ctx_create() or menu_ctx_create_static() and run menu_ctx_run() in its
+ * own task.
+ *
+ */
+typedef struct menu_ctx {
+  menu_config_t *config;
+  /**< Configuration, read on every command so it can change at runtime. */
+  menu_path_t path;
+  /**< Current location. */
+  menu_path_entry_t *stack;
+  /**< Levels above the current one, stack_inline, heap or buffers. */
+  uint8_t stack_size;
+  /**< Entries of stack. */
+  uint8_t depth;
+  /**< Number of open submenus. */
+  menu_path_entry_t stack_inline[CONFIG_MENU_PATH_STACK_INLINE];
+  /**< internal management */
+  uint32_t path_overflows;
+  /**< Submenus not opened, beyond CONFIG_MAX_DEPTH_PATH or out of memory. */
+  menu_virtual_entry_t opened;
+  /**< Copy of the current menu when it is a child of a virtual node. */
+  menu_virtual_entry_t cache[CONFIG_MENU_VIRTUAL_CACHE_SIZE];
+  /**< Children of virtual nodes built by the menu task. */
+  menu_ctx_static_t *buffers;
+  /**< Memory of menu_ctx_create_static(), NULL when allocated. */
+  QueueHandle_t commands;
+  /**< Queue of menu_command_t. */
+  TaskHandle_t function;
+  /**< Task of running function or NULL. */
+  EventGroupHandle_t events;
+  /**< internal management */
+  uint32_t merged;
+  /**< Number of UP/DOWN commands merged into a previous one. */
+  int64_t last_move;
+  /**< internal management */
+  uint32_t accel_streak;
+  /**< internal management */
+  int64_t select_time;
+  /**< internal management */
+  struct menu_index *index;
+  /**< Path index, NULL without CONFIG_MENU_PATH_INDEX. */
+  menu_value_t *editing;
+  /**< Value being edited or NULL. */
+  TaskHandle_t render_task;
+  /**< Task drawing snapshots with CONFIG_MENU_RENDER_TASK. */
+  menu_path_t snapshot;
+  /**< Newest state published for render_task. */
+  menu_virtual_entry_t snapshot_menu;
+  /**< internal management */
+  bool snapshot_pending;
+  /**< snapshot not drawn yet. */
+  portMUX_TYPE snapshot_lock;
+  /**< internal management */
+#if CONFIG_MENU_RENDER_TASK
+  menu_virtual_entry_t render_cache[CONFIG_MENU_VIRTUAL_CACHE_SIZE];
+  /**< Children of virtual nodes built by render_task. */
+#endif
+#if CONFIG_MENU_TRACE
+  menu_trace_slot_t trace[CONFIG_MENU_TRACE_SIZE];
+  /**< Ring of the last traced commands. */
+  uint32_t trace_head;
+  /**< Positions written to the ring. */
+  uint32_t trace_start;
+  /**< First position read, moved by menu_trace_reset(). */
+  menu_trace_record_t trace_record;
+  /**< Command being processed. */
+  menu_trace_record_t snapshot_trace;
+  /**< Command of snapshot not drawn yet. */
+  uint32_t trace_stamps[MENU_TRACE_STAMPS];
+  /**< Low 32 bits of the enqueue time of stamped commands, by slot. */
+  uint32_t trace_stamp_next;
+  /**< Slots handed out. */
+#endif
+#if CONFIG_MENU_PERSIST
+  int64_t persist_due;
+  /**< Time the position is saved, 0 when it is saved. */
+  uint32_t persist_saved;
+  /**< Hash of the saved record. */
+#endif
+  struct menu_ctx *next;
+  /**< internal management */
+} menu_ctx_t;
+
+/**
+ * @brief Title of current menu. Use it and the functions below in display
+ * functions so they work with menu_node_t and flash trees.
+ *
+ * @param path Current path.
+ * @return Label of current menu.
+ */
+const char *menu_path_title(const menu_path_t *path);
+
+/**
+ * @brief Number of options of current menu.
+ *
+ * @param path Current path.
+ * @return Number of options.
+ */
+size_t menu_path_num_options(const menu_path_t *path);
+
+/**
+ * @brief Label of one option of current menu.
+ *
+ * @param path Current path.
+ * @param index Index of option.
+ * @return Label of option.
+ */
+const char *menu_path_option_label(const menu_path_t *path, size_t index);
+
+/**
+ * @brief Value of one option of current menu.
+ *
+ * @param path Current path.
+ * @param index Index of option.
+ * @return Value or NULL when the option is not a value.
+ */
+menu_value_t *menu_path_option_value(const menu_path_t *path, size_t index);
+
+/**
+ * @brief Write the text of a value, "42", "3.25", "ON" or an enum label.
+ *
+ * @param value Value.
+ * @param buf Output buffer.
+ * @param size Size of buf.
+ * @return Length of text, like snprintf.
+ */
+int menu_value_format(const menu_value_t *value, char *buf, size_t size);
+
+/**
+ * @brief Drop cached children of a virtual node in every menu instance, use
+ * it when their labels or count changed. Can be called from any task.
+ *
+ * @param menu Virtual node.
+ */
+void menu_virtual_invalidate(menu_virtual_t *menu);
+
+/**
+ * @brief Create a menu instance. It does not draw anything until
+ * menu_ctx_run() starts.
+ *
+ * @param ctx Storage for the instance, must live while the menu runs.
+ * @param config Configuration, must live while the menu runs.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM.
+ */
+MENU_HEAP_API esp_err_t menu_ctx_create(menu_ctx_t *ctx,
+                                        menu_config_t *config);
+
+/**
+ * @brief Create a menu instance in caller memory, nothing is allocated now
+ * or while it runs. Its render task and the task of its functions use
+ * buffers. No path index is built, menu_ctx_goto() returns
+ * ESP_ERR_NOT_SUPPORTED.
+ *
+ * @param ctx Storage for the instance, must live while the menu runs.
+ * @param config Configuration, must live while the menu runs.
+ * @param buffers Memory of queue, tasks and path stack, must live while the
+ * menu runs.
+ * @return ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t menu_ctx_create_static(menu_ctx_t *ctx, menu_config_t *config,
+                                 menu_ctx_static_t *buffers);
+
+/**
+ * @brief Menu loop of one instance, create a task with it.
+ *
+ * @param ctx The menu_ctx_t created with menu_ctx_create().
+ */
+void menu_ctx_run(void *ctx);
+
+/**
+ * @brief Send a command to a menu instance.
+ *
+ * @param ctx Menu instance.
+ * @param command Command to send.
+ * @param wait Ticks to wait when the queue is full.
+ * @return ESP_OK or ESP_ERR_TIMEOUT.
+ */
+esp_err_t menu_ctx_send(menu_ctx_t *ctx, Navigate_t command, TickType_t wait);
+
+/**
+ * @brief Jump straight to a node. With a submenu it opens it, with a function
+ * it selects it in its menu. The menu rebuilds the path stack from the index
+ * built by menu_ctx_create() in O(depth) and redraws once. Can be called
+ * from any task.
+ *
+ * @param ctx Menu instance.
+ * @param path Labels from root joined by '/', like "Settings/Dimmers/Channel
+ * 3", root label not included.
+ * @param wait Ticks to wait when the queue is full.
+ * @return ESP_OK, ESP_ERR_NOT_FOUND, ESP_ERR_TIMEOUT or ESP_ERR_NOT_SUPPORTED
+ * without CONFIG_MENU_PATH_INDEX.
+ */
+esp_err_t menu_ctx_goto(menu_ctx_t *ctx, const char *path, TickType_t wait);
+
+/**
+ * @brief exitFunction() for a given instance.
+ *
+ * @param ctx Menu instance, menu functions receive it as args.
+ */
+void menu_ctx_exit_function(menu_ctx_t *ctx);
+
+/**
+ * @brief execFunction() for a given instance.
+ *
+ * @param ctx Menu instance.
+ * @param function Function to execute, it receives ctx as args.
+ */
+void menu_ctx_exec_function(menu_ctx_t *ctx, void (*function)(void *args));
+
+/**
+ * @brief Redraw a menu instance from a running function.
+ *
+ * @param ctx Menu instance.
+ */
+void menu_ctx_redraw(menu_ctx_t *ctx);
+
 /**
  * Start menu system that receive generic input function and generic
- * display function.
+ * display function. Runs the default instance, used by qCommands,
+ * exitFunction(), execFunction() and setQuick_menuFunction().
  *
  * @param params The struct that there are args.
  */
-void menu_init(void *params);
+MENU_HEAP_API void menu_init(void *params);
+
+/**
+ * @brief Create the default instance with menu_ctx_create_static(), so
+ * qCommands, exitFunction(), execFunction() and setQuick_menuFunction() work
+ * without allocating. Run it with menu_ctx_run(menu_default_ctx()) from a
+ * task of the application.
+ *
+ * @param config Configuration, must live while the menu runs.
+ * @param buffers Memory of the instance, must live while the menu runs.
+ * @return Same as menu_ctx_create_static().
+ */
+esp_err_t menu_default_ctx_create_static(menu_config_t *config,
+                                         menu_ctx_static_t *buffers);
 
 /**
- * @brief Use this function all option menus when finish
+ * @brief Default instance started by menu_init().
+ *
+ * @return Default instance or NULL before menu_init().
+ */
+menu_ctx_t *menu_default_ctx(void);
+
+/**
+ * @brief menu_ctx_send() on the default instance, waits while its queue is
+ * full.
+ *
+ * @param command Command to send.
+ * @return Same as menu_ctx_send().
+ */
+esp_err_t menu_send(Navigate_t command);
+
+/**
+ * @brief menu_ctx_goto() on the default instance.
+ *
+ * @param path Labels from root joined by '/'.
+ * @return Same as menu_ctx_goto().
+ */
+esp_err_t menu_goto(const char *path);
+
+/**
+ * @brief Use this function all option menus when finish.
+ *
+ * Signals the menu that runs the calling function that it is done and blocks
+ * until the menu has deleted the calling task, so the menu redraws right
+ * away. Never returns: called from a task no menu started, it logs an error
+ * and deletes the calling task.
  */
 void exitFunction(void);
 
 /**
  * @brief Exec especific funtioon
  *
+ * Returns as soon as the function has called exitFunction() or has been
+ * aborted with NAVIGATE_BACK. Called from a menu function it applies to the
+ * menu of that function, elsewhere to the default instance. A menu runs one
+ * function at a time: while one runs, it logs an error and returns without
+ * starting function.
+ *
  * @param Function addres of function
  */
 void execFunction(void (*function)(void *args));
@@ -103,9 +610,20 @@ void execFunction(void (*function)(void *args));
 /**
  * @brief Use this function when your function is a wuick function before
  * end_menuFunction()
+ *
+ * Redraws the menu that started the calling function, the default instance
+ * when no menu did.
  */
 void setQuick_menuFunction(void);
 
+/**
+ * @brief Number of UP/DOWN commands of the default instance merged into a
+ * previous one because they were queued while the menu was redrawing.
+ *
+ * @return Merged commands since menu_init().
+ */
+uint32_t menu_merged_commands(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,215 @@
+/**
+ * @file menu_mirror.h
+ * @brief menu_renderer backend that streams the changes of every flush to a
+ * second view, a serial terminal on a laptop, and feeds the commands it
+ * sends back into the menu.
+ *
+ * Device to host packets:
+ *
+ *     0xA5 0x5A type seq_lo seq_hi len_lo len_hi payload[len] sum
+ *
+ * seq counts packets, a gap means the host lost one and must ask for a full
+ * frame. sum is the low byte of the sum of type, seq, len and payload.
+ *
+ * - MENU_MIRROR_DELTA: runs of changed characters, each row col n chars[n].
+ * - MENU_MIRROR_FULL: cols rows and every character, row by row.
+ * - MENU_MIRROR_GLYPH: slot and the 8 rows of a custom character, shown by
+ *   codes MENU_RENDERER_GLYPH_CODE + slot.
+ *
+ * Host to device commands:
+ *
+ *     0x5A command command^0xFF
+ *
+ * command is NAVIGATE_UP, NAVIGATE_DOWN, NAVIGATE_SELECT, NAVIGATE_BACK or
+ * MENU_MIRROR_RESYNC to get a full frame. tools/menu_mirror.py decodes the
+ * stream on the host.
+ */
+
+#ifndef __MENU_MIRROR_H__
+#define __MENU_MIRROR_H__
+#pragma once
+#include "menu_manager.h"
+#include "menu_renderer.h"
+#include "sdkconfig.h"
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** First two bytes of a device packet. */
+#define MENU_MIRROR_SYNC0 0xA5
+#define MENU_MIRROR_SYNC1 0x5A
+/** First byte of a host command. */
+#define MENU_MIRROR_COMMAND 0x5A
+/** Host command asking for a full frame. */
+#define MENU_MIRROR_RESYNC 0x80
+
+/**
+ * Packet types.
+ *
+ */
+typedef enum {
+  MENU_MIRROR_DELTA = 1,
+  /**< Changed runs of one flush. */
+  MENU_MIRROR_FULL = 2,
+  /**< Whole frame. */
+  MENU_MIRROR_GLYPH = 3,
+  /**< Custom character uploaded. */
+} menu_mirror_packet_t;
+
+/**
+ * Mirror settings.
+ *
+ */
+typedef struct {
+  esp_err_t (*write)(void *arg, const uint8_t *data, size_t len);
+  /**< Send bytes to the host, called several times per packet. */
+  void *arg;
+  /**< User pointer passed to write. */
+  const menu_renderer_backend_t *display;
+  /**< Backend of the real display every call is passed to, copied. NULL
+   * when the mirror is the only view. */
+  menu_renderer_t *renderer;
+  /**< Renderer using the mirror, full frames are read from its buffer. */
+  menu_ctx_t *ctx;
+  /**< Menu receiving the host commands, NULL for menu_default_ctx(). */
+} menu_mirror_config_t;
+
+/**
+ * Run of the flush in progress, points into the frame of the renderer.
+ *
+ */
+typedef struct {
+  const char *data;
+  /**< First character. */
+  uint8_t row;
+  /**< Row. */
+  uint8_t col;
+  /**< First column. */
+  uint8_t len;
+  /**< Characters. */
+} menu_mirror_run_t;
+
+/**
+ * Mirror instance. Fields are internal management except the counters.
+ *
+ */
+typedef struct {
+  menu_mirror_config_t config;
+  /**< Copy of settings. */
+  menu_renderer_backend_t display;
+  /**< Copy of the display backend. */
+  menu_mirror_run_t runs[CONFIG_MENU_MIRROR_MAX_RUNS];
+  /**< Runs written since the last flush. */
+  uint8_t num_runs;
+  /**< Entries of runs, one more than the array when they did not fit. */
+  const uint8_t *glyphs[MENU_RENDERER_GLYPH_SLOTS];
+  /**< Glyph bitmaps uploaded since the last flush. */
+  uint8_t col;
+  /**< Cursor column. */
+  uint8_t row;
+  /**< Cursor row. */
+  bool display_dirty;
+  /**< The display got writes since its last flush. */
+  volatile bool resync;
+  /**< Send a full frame on the next flush. */
+  uint16_t seq;
+  /**< Sequence number of the next packet. */
+  uint8_t parse[3];
+  /**< Bytes of the host command being received. */
+  uint8_t parsed;
+  /**< Bytes in parse. */
+  TaskHandle_t task;
+  /**< UART receive task of menu_mirror_uart_start(). */
+  int uart;
+  /**< UART port of menu_mirror_uart_start(). */
+  uint32_t packets;
+  /**< Packets sent. */
+  uint32_t bytes;
+  /**< Bytes sent. */
+  uint32_t commands;
+  /**< Host commands posted to the menu. */
+  uint32_t rejected;
+  /**< Host bytes dropped: bad check, unknown command or full queue. */
+} menu_mirror_t;
+
+/** Stack of the UART receive task. */
+#define MENU_MIRROR_UART_TASK_STACK 2048
+
+/**
+ * Memory of the receive task of menu_mirror_uart_start_static().
+ *
+ */
+typedef struct {
+  StaticTask_t task;
+  /**< internal management */
+  StackType_t stack[MENU_MIRROR_UART_TASK_STACK];
+  /**< internal management */
+} menu_mirror_uart_static_t;
+
+/**
+ * @brief Initialize a mirror. The first flush sends a full frame.
+ *
+ * @param mirror Instance to initialize.
+ * @param config Settings, copied.
+ * @return ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t menu_mirror_init(menu_mirror_t *mirror,
+                           const menu_mirror_config_t *config);
+
+/**
+ * @brief Backend for menu_renderer_init(). It records the runs the renderer
+ * writes and sends them in one packet when the renderer flushes. It also
+ * passes every call on to the display backend of the config.
+ *
+ * @param mirror Mirror.
+ * @param backend Output.
+ */
+void menu_mirror_backend(menu_mirror_t *mirror,
+                         menu_renderer_backend_t *backend);
+
+/**
+ * @brief Parse bytes received from the host and post its commands to the
+ * menu. A resync request also posts NAVIGATE_REFRESH so the full frame is
+ * sent without waiting for a change. Call from one task only.
+ *
+ * @param mirror Mirror.
+ * @param data Received bytes.
+ * @param len Number of bytes.
+ */
+void menu_mirror_feed(menu_mirror_t *mirror, const uint8_t *data, size_t len);
+
+/**
+ * @brief Send over an installed UART driver and read host commands from it
+ * in a task. Not available on the linux target.
+ *
+ * @param mirror Mirror, its write and arg are replaced.
+ * @param uart UART port with uart_driver_install() done.
+ * @return ESP_OK or ESP_ERR_NO_MEM.
+ */
+MENU_HEAP_API esp_err_t menu_mirror_uart_start(menu_mirror_t *mirror,
+                                               int uart);
+
+/**
+ * @brief menu_mirror_uart_start() with the receive task in caller memory.
+ *
+ * @param mirror Mirror, its write and arg are replaced.
+ * @param uart UART port with uart_driver_install() done.
+ * @param storage Memory of the receive task, must live while the mirror is
+ * used.
+ * @return ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t menu_mirror_uart_start_static(menu_mirror_t *mirror, int uart,
+                                        menu_mirror_uart_static_t *storage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_MIRROR_H__
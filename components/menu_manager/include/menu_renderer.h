@@ -0,0 +1,292 @@
+/**
+ * @file menu_renderer.h
+ * @brief Character framebuffer that sends only changed runs to the display.
+ */
+
+#ifndef __MENU_RENDERER_H__
+#define __MENU_RENDERER_H__
+#pragma once
+#include "menu_alloc.h"
+#include "sdkconfig.h"
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Custom character slots of the display, CGRAM of an HD44780. */
+#define MENU_RENDERER_GLYPH_SLOTS 8
+/** Character code of slot 0, codes 0x08-0x0F avoid the NUL of C strings. */
+#define MENU_RENDERER_GLYPH_CODE 0x08
+
+/**
+ * Custom 5x8 character. Its address is its identity in the glyph cache, so
+ * define glyphs as static or global constants.
+ *
+ */
+typedef struct {
+  uint8_t bitmap[8];
+  /**< 8 rows of 5 bits, top row first. */
+  char fallback;
+  /**< Shown when no slot is free or the backend has no custom characters. */
+} menu_renderer_glyph_t;
+
+/**
+ * Functions that move the cursor and write characters on the real display.
+ *
+ */
+typedef struct {
+  void *ctx;
+  /**< User pointer passed to every callback. */
+  esp_err_t (*set_cursor)(void *ctx, uint8_t col, uint8_t row);
+  /**< Move display cursor to col, row. */
+  esp_err_t (*write)(void *ctx, const char *data, size_t len);
+  /**< Write len characters from the cursor position. */
+  esp_err_t (*flush)(void *ctx);
+  /**< Optional, called at the end of every flush, also when nothing
+   * changed, so buffering backends can send what they hold. */
+  esp_err_t (*upload_glyph)(void *ctx, uint8_t slot, const uint8_t bitmap[8]);
+  /**< Optional, write a custom character slot. The cursor may move. */
+} menu_renderer_backend_t;
+
+/** Bytes of the buffer of menu_renderer_init_static(), both framebuffers. */
+#define MENU_RENDERER_BUFFER_SIZE(cols, rows) (2 * (size_t)(cols) * (rows))
+
+/** Marquee windows of one frame, enough for a title and a selected row. */
+#define MENU_RENDERER_MARQUEES 4
+
+/**
+ * Window of a frame whose text scrolls.
+ *
+ */
+typedef struct {
+  const char *text;
+  /**< Text, NULL for a free window. */
+  size_t len;
+  /**< Length of text. */
+  uint8_t col;
+  /**< First column. */
+  uint8_t row;
+  /**< Row. */
+  uint8_t width;
+  /**< Columns of the window. */
+  uint32_t start;
+  /**< Step the text was first drawn at. */
+  bool drawn;
+  /**< Drawn in the frame being drawn. */
+} menu_renderer_marquee_t;
+
+/**
+ * Glyph held by a custom character slot.
+ *
+ */
+typedef struct {
+  const menu_renderer_glyph_t *glyph;
+  /**< Glyph in the slot, NULL when free. */
+  uint32_t used;
+  /**< Frame that used it last. */
+  bool upload;
+  /**< Not on the display yet, sent by the next flush. */
+} menu_renderer_slot_t;
+
+/**
+ * Framebuffer of rows x cols characters. The display function draws the full
+ * frame and menu_renderer_flush() sends only what changed since last flush.
+ *
+ */
+typedef struct menu_renderer {
+  uint8_t cols;
+  /**< Number of characters per row. */
+  uint8_t rows;
+  /**< Number of rows. */
+  char *frame;
+  /**< Frame being drawn. */
+  char *shown;
+  /**< Frame that is on the display. */
+  bool caller_buffer;
+  /**< frame and shown are the buffer of menu_renderer_init_static(). */
+  uint8_t cursor_col;
+  /**< Column of display cursor after last write. */
+  uint8_t cursor_row;
+  /**< Row of display cursor after last write. */
+  bool cursor_valid;
+  /**< False when display cursor position is unknown. */
+  bool invalid;
+  /**< Next flush rewrites every character. */
+  uint8_t merge_gap;
+  /**< Unchanged characters rewritten to join two runs instead of moving the
+   * cursor. */
+  menu_renderer_backend_t backend;
+  /**< Display callbacks. */
+  uint32_t frame_count;
+  /**< Flushes done, the frame being drawn for the glyph cache. */
+  menu_renderer_slot_t slots[MENU_RENDERER_GLYPH_SLOTS];
+  /**< Glyph cache, least recently used slot is reused on a miss. */
+  uint32_t glyph_hits;
+  /**< Glyphs found in a slot. */
+  uint32_t glyph_misses;
+  /**< Glyphs that took a slot and an upload. */
+  uint32_t glyph_fallbacks;
+  /**< Glyphs drawn as their fallback character. */
+  menu_renderer_marquee_t marquees[MENU_RENDERER_MARQUEES];
+  /**< Scrolling windows of the frame on screen and the one being drawn. */
+  volatile uint32_t marquee_step;
+  /**< Steps of the shared marquee timer while this renderer scrolls. */
+  void (*marquee_redraw)(void *arg);
+  /**< Called from the timer task on every step, must make the owner of the
+   * renderer draw and flush a frame without blocking or flushing itself. */
+  void *marquee_arg;
+  /**< User pointer passed to marquee_redraw. */
+  bool scrolling;
+  /**< Stepped by the shared timer. */
+  struct menu_renderer *marquee_next;
+  /**< internal management */
+} menu_renderer_t;
+
+/**
+ * @brief Allocate framebuffers and set the backend.
+ *
+ * @param renderer Renderer to initialize.
+ * @param cols Characters per row of the display.
+ * @param rows Rows of the display.
+ * @param backend Display callbacks, copied into renderer.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM.
+ */
+MENU_HEAP_API esp_err_t menu_renderer_init(
+    menu_renderer_t *renderer, uint8_t cols, uint8_t rows,
+    const menu_renderer_backend_t *backend);
+
+/**
+ * @brief menu_renderer_init() with framebuffers in caller memory.
+ *
+ * @param renderer Renderer to initialize.
+ * @param cols Characters per row of the display.
+ * @param rows Rows of the display.
+ * @param backend Display callbacks, copied into renderer.
+ * @param buffer MENU_RENDERER_BUFFER_SIZE(cols, rows) bytes, must live while
+ * the renderer is used.
+ * @return ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t menu_renderer_init_static(menu_renderer_t *renderer, uint8_t cols,
+                                    uint8_t rows,
+                                    const menu_renderer_backend_t *backend,
+                                    char *buffer);
+
+/**
+ * @brief Stop scrolling and free framebuffers, the buffer of
+ * menu_renderer_init_static() is left to the caller.
+ *
+ * @param renderer Renderer to free.
+ */
+void menu_renderer_deinit(menu_renderer_t *renderer);
+
+/**
+ * @brief Fill the frame being drawn with spaces.
+ *
+ * @param renderer Renderer.
+ */
+void menu_renderer_clear(menu_renderer_t *renderer);
+
+/**
+ * @brief Put one character in the frame, ignored out of the display.
+ *
+ * @param renderer Renderer.
+ * @param col Column.
+ * @param row Row.
+ * @param c Character.
+ */
+void menu_renderer_putc(menu_renderer_t *renderer, uint8_t col, uint8_t row,
+                        char c);
+
+/**
+ * @brief Put a string in the frame, clipped at the end of the row.
+ *
+ * @param renderer Renderer.
+ * @param col Column of first character.
+ * @param row Row.
+ * @param str String.
+ * @return Column after the last character written.
+ */
+uint8_t menu_renderer_puts(menu_renderer_t *renderer, uint8_t col,
+                           uint8_t row, const char *str);
+
+/**
+ * @brief Put text in a window of a row. Text longer than the window scrolls
+ * while the same text is drawn in the same window frame after frame: it
+ * holds CONFIG_MENU_RENDERER_MARQUEE_HOLD steps at both ends and moves one
+ * character per step. Only the window changes between two steps, so the
+ * flush rewrites only that segment of the row.
+ *
+ * @param renderer Renderer, with menu_renderer_set_marquee() to scroll.
+ * @param col First column of the window.
+ * @param row Row.
+ * @param width Columns of the window, clipped at the end of the row.
+ * @param text Text, the same pointer and length keep scrolling.
+ * @return Column after the window.
+ */
+uint8_t menu_renderer_marquee(menu_renderer_t *renderer, uint8_t col,
+                              uint8_t row, uint8_t width, const char *text);
+
+/**
+ * @brief Set what draws the next frame when a marquee steps. The shared
+ * timer calls redraw only while the frame on screen has scrolling text,
+ * without long text it does not run.
+ *
+ * @param renderer Renderer.
+ * @param redraw Called from the esp_timer task, the FreeRTOS timer task with
+ * CONFIG_MENU_NO_HEAP, NULL to never scroll.
+ * @param arg User pointer passed to redraw.
+ */
+void menu_renderer_set_marquee(menu_renderer_t *renderer,
+                               void (*redraw)(void *arg), void *arg);
+
+/**
+ * @brief Character code that shows a glyph in the frame being drawn, to use
+ * with menu_renderer_putc() or inside strings. On a miss the least recently
+ * used slot not drawn in this frame gets the glyph and the next flush
+ * uploads it. Characters of the evicted glyph still in the frame are
+ * replaced by its fallback.
+ *
+ * @param renderer Renderer.
+ * @param glyph Glyph.
+ * @return Slot character code, or the fallback when every slot is drawn in
+ * this frame or the backend has no upload_glyph.
+ */
+char menu_renderer_glyph(menu_renderer_t *renderer,
+                         const menu_renderer_glyph_t *glyph);
+
+/**
+ * @brief Put a glyph in the frame, see menu_renderer_glyph().
+ *
+ * @param renderer Renderer.
+ * @param col Column.
+ * @param row Row.
+ * @param glyph Glyph.
+ */
+void menu_renderer_put_glyph(menu_renderer_t *renderer, uint8_t col,
+                             uint8_t row, const menu_renderer_glyph_t *glyph);
+
+/**
+ * @brief Force next flush to rewrite the whole display and upload the cached
+ * glyphs again. Use it when something else wrote on the display.
+ *
+ * @param renderer Renderer.
+ */
+void menu_renderer_invalidate(menu_renderer_t *renderer);
+
+/**
+ * @brief Upload new glyphs and send changed runs of the frame to the backend.
+ *
+ * @param renderer Renderer.
+ * @return First error returned by the backend or ESP_OK.
+ */
+esp_err_t menu_renderer_flush(menu_renderer_t *renderer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_RENDERER_H__
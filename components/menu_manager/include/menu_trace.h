@@ -0,0 +1,110 @@
+/**
+ * @file menu_trace.h
+ * @brief Per-command latency tracing of a menu instance, enabled with
+ * CONFIG_MENU_TRACE.
+ */
+
+#ifndef __MENU_TRACE_H__
+#define __MENU_TRACE_H__
+#pragma once
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Buckets of menu_trace_stat_t::histogram. Bucket 0 counts durations up to
+ * 15 us, bucket n from 8 << n to (16 << n) - 1 us and the last bucket
+ * everything longer.
+ */
+#define MENU_TRACE_BUCKETS 16
+
+/**
+ * Statistics of one stage in microseconds.
+ *
+ */
+typedef struct {
+  uint32_t count;
+  /**< Commands that went through the stage. */
+  uint32_t min;
+  /**< Shortest duration. */
+  uint32_t max;
+  /**< Longest duration. */
+  uint32_t avg;
+  /**< Mean duration. */
+  uint32_t histogram[MENU_TRACE_BUCKETS];
+  /**< Count of durations per power of two bucket. */
+} menu_trace_stat_t;
+
+/**
+ * Statistics of the commands in the trace ring.
+ *
+ */
+typedef struct {
+  uint32_t records;
+  /**< Records read from the ring. */
+  uint32_t unshown;
+  /**< Records without a frame. */
+  menu_trace_stat_t queue;
+  /**< Enqueued to dequeued, stamped commands only. */
+  menu_trace_stat_t process;
+  /**< Dequeued to state changed. */
+  menu_trace_stat_t show;
+  /**< State changed to display function returned. */
+  menu_trace_stat_t total;
+  /**< Enqueued, or dequeued when not stamped, to display function
+   * returned. */
+} menu_trace_summary_t;
+
+#if CONFIG_MENU_TRACE
+
+/**
+ * @brief Add the enqueue time to an item sent to the queue of a menu
+ * without menu_ctx_send(). Safe in ISRs. The time is kept in one of
+ * MENU_TRACE_STAMPS slots of ctx, reused once that many more items were
+ * stamped.
+ *
+ * @param ctx Menu instance the item is sent to.
+ * @param item Item to send.
+ */
+void menu_trace_stamp(menu_ctx_t *ctx, menu_command_t *item);
+
+/**
+ * @brief Copy the newest records of the ring, oldest first.
+ *
+ * @param ctx Menu instance.
+ * @param records Output array.
+ * @param max Size of records.
+ * @return Records copied.
+ */
+size_t menu_trace_read(menu_ctx_t *ctx, menu_trace_record_t *records,
+                       size_t max);
+
+/**
+ * @brief Min, avg, max and histogram of every stage over the records in the
+ * ring. Can be called from any task while the menu runs.
+ *
+ * @param ctx Menu instance.
+ * @param summary Output.
+ */
+void menu_trace_summary(menu_ctx_t *ctx, menu_trace_summary_t *summary);
+
+/**
+ * @brief Forget the records in the ring.
+ *
+ * @param ctx Menu instance.
+ */
+void menu_trace_reset(menu_ctx_t *ctx);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_TRACE_H__
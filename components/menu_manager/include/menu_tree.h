@@ -0,0 +1,95 @@
+/**
+ * @file menu_tree.h
+ * @brief Packed menu tree stored in flash, generated at build time by
+ * menu_tree_generate() from a text description.
+ */
+
+#ifndef __MENU_TREE_H__
+#define __MENU_TREE_H__
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Value of menu_tree_node_t::function for submenus.
+ */
+#define MENU_TREE_NO_FUNCTION 0xFFFF
+
+/**
+ * One node of a packed tree. Children of a node are consecutive in the node
+ * array, node 0 is the root.
+ *
+ */
+typedef struct {
+  uint16_t label;
+  /**< Offset of label in string pool. */
+  uint16_t first_child;
+  /**< Index of first child. */
+  uint16_t num_children;
+  /**< Number of children. */
+  uint16_t function;
+  /**< Index in function table or MENU_TREE_NO_FUNCTION. */
+} menu_tree_node_t;
+
+/**
+ * Packed tree, every table is const so the whole tree stays in flash.
+ *
+ */
+typedef struct {
+  const menu_tree_node_t *nodes;
+  /**< Node array. */
+  uint16_t num_nodes;
+  /**< Number of nodes. */
+  const char *strings;
+  /**< String pool of NUL terminated labels. */
+  void (*const *functions)(void *args);
+  /**< Function table. */
+} menu_tree_t;
+
+/**
+ * @brief Label of a node.
+ *
+ * @param tree Tree.
+ * @param node Node index.
+ * @return Label.
+ */
+const char *menu_tree_label(const menu_tree_t *tree, uint16_t node);
+
+/**
+ * @brief Number of children of a node.
+ *
+ * @param tree Tree.
+ * @param node Node index.
+ * @return Number of children.
+ */
+uint16_t menu_tree_num_children(const menu_tree_t *tree, uint16_t node);
+
+/**
+ * @brief Index of a child of a node.
+ *
+ * @param tree Tree.
+ * @param node Node index.
+ * @param index Position of child.
+ * @return Node index of child.
+ */
+uint16_t menu_tree_child(const menu_tree_t *tree, uint16_t node,
+                         uint16_t index);
+
+/**
+ * @brief Function of a leaf node.
+ *
+ * @param tree Tree.
+ * @param node Node index.
+ * @return Function or NULL for submenus.
+ */
+void (*menu_tree_function(const menu_tree_t *tree, uint16_t node))(void *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MENU_TREE_H__
@@ -0,0 +1,316 @@
+#include "menu_hd44780.h"
+#include "esp_err.h"
+#include "menu_renderer.h"
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+const static char *TAG = "menu_hd44780";
+
+#define CMD_CLEAR 0x01
+#define CMD_ENTRY_MODE 0x06
+#define CMD_DISPLAY_ON 0x0C
+#define CMD_FUNCTION_4BIT 0x28
+#define CMD_CGRAM_ADDR 0x40
+#define CMD_DDRAM_ADDR 0x80
+
+static esp_err_t Send(menu_hd44780_t *lcd, const uint8_t *data, size_t len) {
+  esp_err_t err = lcd->config.bus_write(lcd->config.arg, data, len);
+
+  lcd->transactions++;
+  lcd->bytes += len;
+  return err;
+}
+
+static void SenderTask(void *args) {
+  menu_hd44780_t *lcd = (menu_hd44780_t *)args;
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    uint8_t sending = lcd->fill ^ 1;
+    esp_err_t err = Send(lcd, lcd->buffers[sending], lcd->len[sending]);
+    if (err != ESP_OK && lcd->error == ESP_OK)
+      lcd->error = err;
+    lcd->len[sending] = 0;
+    xSemaphoreGive(lcd->idle);
+  }
+}
+
+// Send the buffer being encoded, or hand it to the sender task and encode
+// into the other one.
+static esp_err_t Emit(menu_hd44780_t *lcd) {
+  uint8_t fill = lcd->fill;
+
+  if (!lcd->len[fill])
+    return ESP_OK;
+
+  if (!lcd->config.async) {
+    esp_err_t err = Send(lcd, lcd->buffers[fill], lcd->len[fill]);
+    lcd->len[fill] = 0;
+    return err;
+  }
+
+  // Only one buffer can be on the bus, wait for the previous one.
+  xSemaphoreTake(lcd->idle, portMAX_DELAY);
+  esp_err_t err = lcd->error;
+  lcd->error = ESP_OK;
+  lcd->fill = fill ^ 1;
+  xTaskNotifyGive(lcd->task);
+  return err;
+}
+
+static uint8_t Port(menu_hd44780_t *lcd, uint8_t nibble, bool data) {
+  const menu_hd44780_pins_t *pins = &lcd->config.pins;
+
+  return lcd->backlight | (data ? 1 << pins->rs : 0) |
+         (nibble & 0x1 ? 1 << pins->d4 : 0) |
+         (nibble & 0x2 ? 1 << pins->d5 : 0) |
+         (nibble & 0x4 ? 1 << pins->d6 : 0) |
+         (nibble & 0x8 ? 1 << pins->d7 : 0);
+}
+
+static esp_err_t Push(menu_hd44780_t *lcd, uint8_t port) {
+  if (lcd->len[lcd->fill] == CONFIG_MENU_HD44780_BUFFER_SIZE) {
+    esp_err_t err = Emit(lcd);
+    if (err != ESP_OK)
+      return err;
+  }
+  lcd->buffers[lcd->fill][lcd->len[lcd->fill]++] = port;
+  lcd->port = port;
+  return ESP_OK;
+}
+
+// A nibble is latched by E going low, so it takes two port bytes.
+static esp_err_t PushNibble(menu_hd44780_t *lcd, uint8_t nibble, bool data) {
+  uint8_t port = Port(lcd, nibble, data);
+  uint8_t e = 1 << lcd->config.pins.e;
+  esp_err_t err = ESP_OK;
+
+  // RS must settle before E rises, add a byte only when it changes.
+  uint8_t rs = 1 << lcd->config.pins.rs;
+  if ((lcd->port ^ port) & rs)
+    err = Push(lcd, port);
+  if (err == ESP_OK)
+    err = Push(lcd, port | e);
+  if (err == ESP_OK)
+    err = Push(lcd, port);
+  return err;
+}
+
+static esp_err_t PushByte(menu_hd44780_t *lcd, uint8_t byte, bool data) {
+  esp_err_t err = PushNibble(lcd, byte >> 4, data);
+  if (err == ESP_OK)
+    err = PushNibble(lcd, byte & 0x0F, data);
+  return err;
+}
+
+static esp_err_t SetCursor(void *ctx, uint8_t col, uint8_t row) {
+  menu_hd44780_t *lcd = (menu_hd44780_t *)ctx;
+  uint8_t cols = lcd->config.cols;
+  const uint8_t rows[4] = {0x00, 0x40, cols, 0x40 + cols};
+
+  return PushByte(lcd, CMD_DDRAM_ADDR | (rows[row & 3] + col), false);
+}
+
+static esp_err_t Write(void *ctx, const char *data, size_t len) {
+  menu_hd44780_t *lcd = (menu_hd44780_t *)ctx;
+
+  for (size_t i = 0; i < len; i++) {
+    esp_err_t err = PushByte(lcd, (uint8_t)data[i], true);
+    if (err != ESP_OK)
+      return err;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t Flush(void *ctx) { return Emit((menu_hd44780_t *)ctx); }
+
+static esp_err_t UploadGlyph(void *ctx, uint8_t slot, const uint8_t bitmap[8]) {
+  return menu_hd44780_upload_glyph((menu_hd44780_t *)ctx, slot, bitmap);
+}
+
+// Instruction sent on its own, for the ones that need a delay after them.
+static esp_err_t Instruction(menu_hd44780_t *lcd, uint8_t nibble, bool full,
+                             uint32_t delay_ms) {
+  esp_err_t err = full ? PushByte(lcd, nibble, false)
+                       : PushNibble(lcd, nibble, false);
+  if (err == ESP_OK)
+    err = menu_hd44780_sync(lcd);
+  if (delay_ms)
+    vTaskDelay(pdMS_TO_TICKS(delay_ms) + 1);
+  return err;
+}
+
+static bool ValidConfig(menu_hd44780_t *lcd,
+                        const menu_hd44780_config_t *config) {
+  return lcd && config && config->bus_write && config->cols &&
+         config->rows && config->rows <= 4;
+}
+
+static void Reset(menu_hd44780_t *lcd, const menu_hd44780_config_t *config) {
+  *lcd = (menu_hd44780_t){
+      .config = *config,
+      .backlight = config->backlight ? 1 << config->pins.bl : 0,
+  };
+}
+
+static esp_err_t PowerOn(menu_hd44780_t *lcd) {
+  esp_err_t err;
+
+  // Power on sequence of the datasheet, the controller can be in 8 or 4 bit
+  // mode or in the middle of a nibble.
+  vTaskDelay(pdMS_TO_TICKS(50));
+  err = Instruction(lcd, 0x3, false, 5);
+  if (err == ESP_OK)
+    err = Instruction(lcd, 0x3, false, 1);
+  if (err == ESP_OK)
+    err = Instruction(lcd, 0x3, false, 1);
+  if (err == ESP_OK)
+    err = Instruction(lcd, 0x2, false, 1);
+  if (err == ESP_OK)
+    err = Instruction(lcd, CMD_FUNCTION_4BIT, true, 0);
+  if (err == ESP_OK)
+    err = Instruction(lcd, CMD_DISPLAY_ON, true, 0);
+  if (err == ESP_OK)
+    err = Instruction(lcd, CMD_CLEAR, true, 2);
+  if (err == ESP_OK)
+    err = Instruction(lcd, CMD_ENTRY_MODE, true, 0);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Init failed: %s", esp_err_to_name(err));
+    menu_hd44780_deinit(lcd);
+  }
+  return err;
+}
+
+#if !CONFIG_MENU_NO_HEAP
+esp_err_t menu_hd44780_init(menu_hd44780_t *lcd,
+                            const menu_hd44780_config_t *config) {
+  if (!ValidConfig(lcd, config))
+    return ESP_ERR_INVALID_ARG;
+
+  Reset(lcd, config);
+  lcd->buffers[0] = malloc(CONFIG_MENU_HD44780_BUFFER_SIZE);
+  lcd->buffers[1] = config->async ? malloc(CONFIG_MENU_HD44780_BUFFER_SIZE)
+                                  : NULL;
+  if (!lcd->buffers[0] || (config->async && !lcd->buffers[1])) {
+    ESP_LOGE(TAG, "No memory for buffers");
+    menu_hd44780_deinit(lcd);
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (config->async) {
+    lcd->idle = xSemaphoreCreateBinary();
+    if (!lcd->idle ||
+        xTaskCreate(SenderTask, "menu_hd44780", MENU_HD44780_TASK_STACK, lcd,
+                    CONFIG_MENU_HD44780_TASK_PRIORITY, &lcd->task) != pdPASS) {
+      ESP_LOGE(TAG, "No memory for sender task");
+      menu_hd44780_deinit(lcd);
+      return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(lcd->idle);
+  }
+  return PowerOn(lcd);
+}
+#endif
+
+esp_err_t menu_hd44780_init_static(menu_hd44780_t *lcd,
+                                   const menu_hd44780_config_t *config,
+                                   menu_hd44780_static_t *storage) {
+  if (!ValidConfig(lcd, config) || !storage)
+    return ESP_ERR_INVALID_ARG;
+
+  Reset(lcd, config);
+  lcd->storage = storage;
+  lcd->buffers[0] = storage->buffers[0];
+  if (config->async) {
+    lcd->buffers[1] = storage->buffers[1];
+    lcd->idle = xSemaphoreCreateBinaryStatic(&storage->idle);
+    lcd->task = xTaskCreateStatic(
+        SenderTask, "menu_hd44780", MENU_HD44780_TASK_STACK, lcd,
+        CONFIG_MENU_HD44780_TASK_PRIORITY, storage->stack, &storage->task);
+    xSemaphoreGive(lcd->idle);
+  }
+  return PowerOn(lcd);
+}
+
+void menu_hd44780_deinit(menu_hd44780_t *lcd) {
+  if (lcd->task) {
+    xSemaphoreTake(lcd->idle, portMAX_DELAY);
+    vTaskDelete(lcd->task);
+    lcd->task = NULL;
+  }
+  if (lcd->idle) {
+    vSemaphoreDelete(lcd->idle);
+    lcd->idle = NULL;
+  }
+#if !CONFIG_MENU_NO_HEAP
+  if (!lcd->storage) {
+    free(lcd->buffers[0]);
+    free(lcd->buffers[1]);
+  }
+#endif
+  lcd->buffers[0] = NULL;
+  lcd->buffers[1] = NULL;
+}
+
+void menu_hd44780_backend(menu_hd44780_t *lcd,
+                          menu_renderer_backend_t *backend) {
+  *backend = (menu_renderer_backend_t){
+      .ctx = lcd,
+      .set_cursor = SetCursor,
+      .write = Write,
+      .flush = Flush,
+      .upload_glyph = UploadGlyph,
+  };
+}
+
+esp_err_t menu_hd44780_set_backlight(menu_hd44780_t *lcd, bool on) {
+  bool pending = lcd->len[lcd->fill] != 0;
+
+  lcd->backlight = on ? 1 << lcd->config.pins.bl : 0;
+  esp_err_t err = Push(lcd, (lcd->port & ~(1 << lcd->config.pins.bl)) |
+                                lcd->backlight);
+  if (err == ESP_OK && !pending)
+    err = Emit(lcd);
+  return err;
+}
+
+esp_err_t menu_hd44780_upload_glyph(menu_hd44780_t *lcd, uint8_t slot,
+                                    const uint8_t bitmap[8]) {
+  if (slot > 7)
+    return ESP_ERR_INVALID_ARG;
+
+  esp_err_t err = PushByte(lcd, CMD_CGRAM_ADDR | slot << 3, false);
+  for (uint8_t row = 0; row < 8 && err == ESP_OK; row++)
+    err = PushByte(lcd, bitmap[row] & 0x1F, true);
+  return err;
+}
+
+esp_err_t menu_hd44780_sync(menu_hd44780_t *lcd) {
+  esp_err_t err = Emit(lcd);
+
+  if (lcd->config.async) {
+    xSemaphoreTake(lcd->idle, portMAX_DELAY);
+    if (err == ESP_OK)
+      err = lcd->error;
+    lcd->error = ESP_OK;
+    xSemaphoreGive(lcd->idle);
+  }
+  return err;
+}
+
+#ifdef __cplusplus
+}
+#endif
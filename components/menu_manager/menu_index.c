@@ -0,0 +1,179 @@
+#include "menu_index.h"
+#include "esp_err.h"
+#include "menu_manager.h"
+#include "menu_tree.h"
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if !CONFIG_MENU_NO_HEAP
+const static char *TAG = "menu_index";
+#endif
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static uint32_t Hash(uint32_t hash, const char *str, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)str[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static const char *EntryLabel(const menu_path_t *root,
+                              const menu_index_entry_t *entry) {
+  if (root->tree)
+    return menu_tree_label(root->tree, entry->tree_node);
+  return entry->node->label;
+}
+
+#if !CONFIG_MENU_NO_HEAP
+static size_t Children(const menu_path_t *root,
+                       const menu_index_entry_t *entry) {
+  if (root->tree)
+    return menu_tree_num_children(root->tree, entry->tree_node);
+  if (entry->node->virtual_menu)
+    return 0;
+  return entry->node->num_options;
+}
+
+static void SetChild(const menu_path_t *root, const menu_index_entry_t *parent,
+                     size_t index, menu_index_entry_t *child) {
+  if (root->tree) {
+    child->tree_node = menu_tree_child(root->tree, parent->tree_node, index);
+  } else {
+    child->node = &parent->node->submenus[index];
+  }
+}
+
+// Walks the tree depth first and numbers the nodes. With entries NULL it
+// only counts them.
+static uint16_t Visit(const menu_path_t *root, menu_index_entry_t *entries,
+                      const menu_index_entry_t *entry, uint16_t self,
+                      uint16_t next, uint8_t depth) {
+  size_t children = Children(root, entry);
+
+  if (depth + 1 >= CONFIG_MAX_DEPTH_PATH)
+    return next;
+
+  for (size_t i = 0; i < children && next != MENU_INDEX_NONE; i++) {
+    menu_index_entry_t child = {.parent = self, .index = i};
+    SetChild(root, entry, i, &child);
+
+    const char *label = EntryLabel(root, &child);
+    uint32_t hash = self == 0 ? FNV_OFFSET : Hash(entry->hash, "/", 1);
+    child.hash = Hash(hash, label, strlen(label));
+
+    uint16_t number = next++;
+    if (entries)
+      entries[number] = child;
+    next = Visit(root, entries, &child, number, next, depth + 1);
+  }
+  return next;
+}
+#endif
+
+static bool Matches(const menu_index_t *index, const menu_path_t *root,
+                    uint16_t entry, const char *path, size_t len) {
+  while (entry != 0) {
+    const char *label = EntryLabel(root, &index->entries[entry]);
+    size_t label_len = strlen(label);
+
+    if (label_len > len || memcmp(path + len - label_len, label, label_len))
+      return false;
+    len -= label_len;
+    entry = index->entries[entry].parent;
+    if (entry != 0) {
+      if (len == 0 || path[len - 1] != '/')
+        return false;
+      len--;
+    }
+  }
+  return len == 0;
+}
+
+#if !CONFIG_MENU_NO_HEAP
+esp_err_t menu_index_build(menu_index_t *index, const menu_path_t *root) {
+  menu_index_entry_t top = {.hash = FNV_OFFSET,
+                            .parent = MENU_INDEX_NONE,
+                            .index = 0};
+  if (root->tree) {
+    top.tree_node = root->current_node;
+  } else {
+    top.node = root->current_menu;
+  }
+
+  uint16_t count = Visit(root, NULL, &top, 0, 1, 0);
+  if (count == MENU_INDEX_NONE)
+    ESP_LOGW(TAG, "Tree too large, only %u nodes indexed", count);
+
+  // At most 0x10000 slots for at most 0xFFFE entries, never full.
+  uint32_t size = 1;
+  while (size < 2u * count && size < 0x10000)
+    size <<= 1;
+
+  index->entries = malloc(sizeof(menu_index_entry_t) * count);
+  index->table = malloc(sizeof(uint16_t) * size);
+  if (!index->entries || !index->table) {
+    menu_index_free(index);
+    return ESP_ERR_NO_MEM;
+  }
+
+  index->entries[0] = top;
+  Visit(root, index->entries, &top, 0, 1, 0);
+
+  index->num_entries = count;
+  index->mask = size - 1;
+  memset(index->table, 0xFF, sizeof(uint16_t) * size);
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t slot = index->entries[i].hash & index->mask;
+    while (index->table[slot] != MENU_INDEX_NONE)
+      slot = (slot + 1) & index->mask;
+    index->table[slot] = i;
+  }
+
+  ESP_LOGI(TAG, "Indexed %u nodes in %u bytes", count,
+           (unsigned)(sizeof(menu_index_entry_t) * count +
+                      sizeof(uint16_t) * size));
+  return ESP_OK;
+}
+
+void menu_index_free(menu_index_t *index) {
+  free(index->entries);
+  free(index->table);
+  *index = (menu_index_t){0};
+}
+#endif
+
+uint16_t menu_index_find(const menu_index_t *index, const menu_path_t *root,
+                         const char *path) {
+  if (!index->table)
+    return MENU_INDEX_NONE;
+
+  size_t len = strlen(path);
+  uint32_t hash = Hash(FNV_OFFSET, path, len);
+
+  for (uint16_t slot = hash & index->mask;
+       index->table[slot] != MENU_INDEX_NONE;
+       slot = (slot + 1) & index->mask) {
+    uint16_t entry = index->table[slot];
+    if (index->entries[entry].hash == hash &&
+        Matches(index, root, entry, path, len)) {
+      return entry;
+    }
+  }
+  return MENU_INDEX_NONE;
+}
+
+#ifdef __cplusplus
+}
+#endif
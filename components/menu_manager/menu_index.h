@@ -0,0 +1,61 @@
+// Path index of a menu instance, private to menu_manager.
+#pragma once
+#include "menu_manager.h"
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MENU_INDEX_NONE 0xFFFF
+
+typedef struct {
+  uint32_t hash;
+  /**< FNV-1a of the slash-joined label path. */
+  uint16_t parent;
+  /**< Entry of parent or MENU_INDEX_NONE for root. */
+  uint16_t index;
+  /**< Position of node in parent. */
+  union {
+    menu_node_t *node;
+    /**< Node of menu_node_t tree. */
+    uint16_t tree_node;
+    /**< Node of flash tree. */
+  };
+} menu_index_entry_t;
+
+typedef struct menu_index {
+  menu_index_entry_t *entries;
+  /**< Entry 0 is the root. */
+  uint16_t num_entries;
+  /**< Number of entries. */
+  uint16_t *table;
+  /**< Open addressing hash table of entry numbers. */
+  uint16_t mask;
+  /**< Table size - 1, size is a power of two. */
+} menu_index_t;
+
+#if !CONFIG_MENU_NO_HEAP
+/**
+ * @brief Index every node reachable within CONFIG_MAX_DEPTH_PATH levels.
+ * Children of virtual nodes are not indexed.
+ */
+esp_err_t menu_index_build(menu_index_t *index, const menu_path_t *root);
+
+void menu_index_free(menu_index_t *index);
+#endif
+
+/**
+ * @brief Entry of a slash-joined label path, "" is the root.
+ *
+ * @return Entry or MENU_INDEX_NONE.
+ */
+uint16_t menu_index_find(const menu_index_t *index, const menu_path_t *root,
+                         const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,343 @@
+#include "menu_input.h"
+#include "esp_err.h"
+#include "menu_manager.h"
+#include "menu_trace.h"
+#include "sdkconfig.h"
+#include <driver/gpio.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+const static char *TAG = "menu_input";
+
+#define ENCODER_STEPS 4
+
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+#define TIMER_DISPATCH ESP_TIMER_ISR
+#else
+#define TIMER_DISPATCH ESP_TIMER_TASK
+#endif
+
+// Step of every change of the A/B state, previous << 2 | current. Changes
+// of both pins at once are bounce and count nothing.
+static const int8_t Transitions[16] = {0, 1,  -1, 0, -1, 0, 0,  1,
+                                       1, 0, 0,  -1, 0, -1, 1, 0};
+
+// Switch to a task the ISR woke. An esp_timer callback dispatched from the
+// esp_timer ISR must leave the yield to esp_timer.
+static void YieldFromIsr(bool timer) {
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD && !CONFIG_MENU_NO_HEAP
+  if (timer) {
+    esp_timer_isr_dispatch_need_yield();
+    return;
+  }
+#endif
+  portYIELD_FROM_ISR();
+}
+
+// timer tells a button timer callback from the encoder GPIO ISR.
+static void Post(menu_ctx_t *ctx, Navigate_t command,
+                 volatile uint32_t *dropped, bool timer) {
+  if (!ctx)
+    ctx = menu_default_ctx();
+  if (!ctx || !ctx->commands) {
+    (*dropped)++;
+    return;
+  }
+
+  menu_command_t item = {.command = command};
+#if CONFIG_MENU_TRACE
+  menu_trace_stamp(ctx, &item);
+#endif
+  if (xPortInIsrContext()) {
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(ctx->commands, &item, &woken) != pdTRUE)
+      (*dropped)++;
+    if (woken)
+      YieldFromIsr(timer);
+  } else if (xQueueSend(ctx->commands, &item, 0) != pdTRUE) {
+    (*dropped)++;
+  }
+}
+
+static bool Pressed(const menu_input_button_t *button) {
+  return gpio_get_level(button->gpio) == button->active_high;
+}
+
+#if CONFIG_MENU_NO_HEAP
+static void StartDebounce(menu_input_button_t *button) {
+  if (xPortInIsrContext()) {
+    BaseType_t woken = pdFALSE;
+    xTimerStartFromISR(button->debounce, &woken);
+    if (woken)
+      portYIELD_FROM_ISR();
+  } else {
+    xTimerStart(button->debounce, 0);
+  }
+}
+
+static void StartLongPress(menu_input_button_t *button, uint32_t ms) {
+  xTimerChangePeriod(button->long_press, pdMS_TO_TICKS(ms) + 1, 0);
+}
+
+static void StopLongPress(menu_input_button_t *button) {
+  xTimerStop(button->long_press, 0);
+}
+#else
+static void StartDebounce(menu_input_button_t *button) {
+  esp_timer_start_once(button->debounce,
+                       CONFIG_MENU_INPUT_DEBOUNCE_MS * 1000ULL);
+}
+
+static void StartLongPress(menu_input_button_t *button, uint32_t ms) {
+  esp_timer_start_once(button->long_press, ms * 1000ULL);
+}
+
+static void StopLongPress(menu_input_button_t *button) {
+  esp_timer_stop(button->long_press);
+}
+#endif
+
+static void ButtonIsr(void *args) {
+  menu_input_button_t *button = (menu_input_button_t *)args;
+
+  // Ignore the bounce, the timer reads the pin once it is stable.
+  gpio_intr_disable(button->gpio);
+  StartDebounce(button);
+}
+
+static void Press(menu_input_button_t *button) {
+  if (button->long_command == NAVIGATE_NOTHING) {
+    Post(button->ctx, button->command, &button->dropped, true);
+    return;
+  }
+
+  uint32_t ms = button->long_press_ms ? button->long_press_ms
+                                      : CONFIG_MENU_INPUT_LONG_PRESS_MS;
+  button->long_sent = false;
+  StartLongPress(button, ms);
+}
+
+static void Release(menu_input_button_t *button) {
+  if (button->long_command == NAVIGATE_NOTHING)
+    return;
+
+  StopLongPress(button);
+  if (!button->long_sent)
+    Post(button->ctx, button->command, &button->dropped, true);
+}
+
+static void DebounceDone(void *args) {
+  menu_input_button_t *button = (menu_input_button_t *)args;
+  bool pressed = Pressed(button);
+
+  if (pressed != button->pressed) {
+    button->pressed = pressed;
+    if (pressed) {
+      Press(button);
+    } else {
+      Release(button);
+    }
+  }
+
+  gpio_intr_enable(button->gpio);
+  // An edge between the read and enabling the interrupt raised nothing.
+  if (Pressed(button) != button->pressed)
+    ButtonIsr(button);
+}
+
+static void LongPress(void *args) {
+  menu_input_button_t *button = (menu_input_button_t *)args;
+
+  button->long_sent = true;
+  Post(button->ctx, button->long_command, &button->dropped, true);
+}
+
+#if CONFIG_MENU_NO_HEAP
+static void DebounceTimer(TimerHandle_t timer) {
+  DebounceDone(pvTimerGetTimerID(timer));
+}
+
+static void LongPressTimer(TimerHandle_t timer) {
+  LongPress(pvTimerGetTimerID(timer));
+}
+
+static esp_err_t CreateTimers(menu_input_button_t *button) {
+  button->debounce = xTimerCreateStatic(
+      "menu_debounce", pdMS_TO_TICKS(CONFIG_MENU_INPUT_DEBOUNCE_MS) + 1,
+      pdFALSE, button, DebounceTimer, &button->debounce_buffer);
+  // Period set by every press.
+  button->long_press =
+      xTimerCreateStatic("menu_long_press", 1, pdFALSE, button,
+                         LongPressTimer, &button->long_press_buffer);
+  return ESP_OK;
+}
+
+static void DeleteTimers(menu_input_button_t *button) {
+  if (button->debounce) {
+    xTimerDelete(button->debounce, portMAX_DELAY);
+    button->debounce = NULL;
+  }
+  if (button->long_press) {
+    xTimerDelete(button->long_press, portMAX_DELAY);
+    button->long_press = NULL;
+  }
+}
+#else
+static esp_err_t CreateTimers(menu_input_button_t *button) {
+  esp_timer_create_args_t debounce = {
+      .callback = DebounceDone,
+      .arg = button,
+      .dispatch_method = TIMER_DISPATCH,
+      .name = "menu_debounce",
+  };
+  esp_timer_create_args_t long_press = {
+      .callback = LongPress,
+      .arg = button,
+      .dispatch_method = TIMER_DISPATCH,
+      .name = "menu_long_press",
+  };
+  esp_err_t err = esp_timer_create(&debounce, &button->debounce);
+
+  if (err == ESP_OK)
+    err = esp_timer_create(&long_press, &button->long_press);
+  return err;
+}
+
+static void DeleteTimers(menu_input_button_t *button) {
+  if (button->debounce) {
+    esp_timer_stop(button->debounce);
+    esp_timer_delete(button->debounce);
+    button->debounce = NULL;
+  }
+  if (button->long_press) {
+    esp_timer_stop(button->long_press);
+    esp_timer_delete(button->long_press);
+    button->long_press = NULL;
+  }
+}
+#endif
+
+static void EncoderIsr(void *args) {
+  menu_input_encoder_t *encoder = (menu_input_encoder_t *)args;
+  uint8_t state = gpio_get_level(encoder->pin_a) << 1 |
+                  gpio_get_level(encoder->pin_b);
+  int8_t step = Transitions[encoder->state << 2 | state];
+  int8_t steps = encoder->steps ? encoder->steps : ENCODER_STEPS;
+
+  encoder->state = state;
+  if (!step)
+    return;
+
+  encoder->count += step;
+  if (encoder->count >= steps || encoder->count <= -steps) {
+    bool up = (encoder->count > 0) != encoder->reverse;
+    encoder->count = 0;
+    Post(encoder->ctx, up ? NAVIGATE_UP : NAVIGATE_DOWN, &encoder->dropped,
+         false);
+  }
+}
+
+static esp_err_t InstallIsrService(void) {
+  esp_err_t err = gpio_install_isr_service(0);
+
+  // Installed by someone else is fine.
+  return err == ESP_ERR_INVALID_STATE ? ESP_OK : err;
+}
+
+static esp_err_t ConfigurePins(uint64_t mask, bool pull_down) {
+  gpio_config_t config = {
+      .pin_bit_mask = mask,
+      .mode = GPIO_MODE_INPUT,
+      .pull_up_en = pull_down ? GPIO_PULLUP_DISABLE : GPIO_PULLUP_ENABLE,
+      .pull_down_en = pull_down ? GPIO_PULLDOWN_ENABLE : GPIO_PULLDOWN_DISABLE,
+      .intr_type = GPIO_INTR_ANYEDGE,
+  };
+
+  return gpio_config(&config);
+}
+
+esp_err_t menu_input_button_add(menu_input_button_t *button, menu_ctx_t *ctx) {
+  esp_err_t err;
+
+  if (!button || !GPIO_IS_VALID_GPIO(button->gpio))
+    return ESP_ERR_INVALID_ARG;
+
+  button->ctx = ctx;
+  button->debounce = NULL;
+  button->long_press = NULL;
+  button->dropped = 0;
+  button->long_sent = false;
+
+  err = CreateTimers(button);
+  if (err == ESP_OK)
+    err = ConfigurePins(1ULL << button->gpio, button->active_high);
+  if (err == ESP_OK)
+    err = InstallIsrService();
+  if (err == ESP_OK) {
+    button->pressed = Pressed(button);
+    err = gpio_isr_handler_add(button->gpio, ButtonIsr, button);
+  }
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Button on GPIO %d: %s", button->gpio,
+             esp_err_to_name(err));
+    menu_input_button_remove(button);
+  }
+  return err;
+}
+
+void menu_input_button_remove(menu_input_button_t *button) {
+  gpio_isr_handler_remove(button->gpio);
+  DeleteTimers(button);
+}
+
+esp_err_t menu_input_encoder_add(menu_input_encoder_t *encoder,
+                                 menu_ctx_t *ctx) {
+  esp_err_t err;
+
+  if (!encoder || !GPIO_IS_VALID_GPIO(encoder->pin_a) ||
+      !GPIO_IS_VALID_GPIO(encoder->pin_b) || encoder->steps > 64) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  encoder->ctx = ctx;
+  encoder->count = 0;
+  encoder->dropped = 0;
+
+  err = ConfigurePins(1ULL << encoder->pin_a | 1ULL << encoder->pin_b,
+                      false);
+  if (err == ESP_OK)
+    err = InstallIsrService();
+  if (err == ESP_OK) {
+    encoder->state = gpio_get_level(encoder->pin_a) << 1 |
+                     gpio_get_level(encoder->pin_b);
+    err = gpio_isr_handler_add(encoder->pin_a, EncoderIsr, encoder);
+  }
+  if (err == ESP_OK)
+    err = gpio_isr_handler_add(encoder->pin_b, EncoderIsr, encoder);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Encoder on GPIO %d/%d: %s", encoder->pin_a,
+             encoder->pin_b, esp_err_to_name(err));
+    menu_input_encoder_remove(encoder);
+  }
+  return err;
+}
+
+void menu_input_encoder_remove(menu_input_encoder_t *encoder) {
+  gpio_isr_handler_remove(encoder->pin_a);
+  gpio_isr_handler_remove(encoder->pin_b);
+}
+
+#ifdef __cplusplus
+}
+#endif
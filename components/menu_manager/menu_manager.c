@@ -1,155 +1,1111 @@
 // TODO: Add comments
 #include "menu_manager.h"
+#include "menu_index.h"
+#include "menu_persist.h"
+#include "menu_trace.h"
+#include "menu_trace_hooks.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "freertos/idf_additions.h"
 #include "freertos/portmacro.h"
 #include "freertos/projdefs.h"
 #include "sdkconfig.h"
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "menu_no_heap.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 const static char *TAG = "menu_menager";
 
+#define FUNCTION_DONE_BIT BIT0
+#define RENDER_IDLE_BIT BIT1
+
+#if CONFIG_FREERTOS_UNICORE
+#define FUNCTION_CORE 0
+#else
+#define FUNCTION_CORE 1
+#endif
+
 TaskHandle_t tMenuFunction = NULL;
 QueueHandle_t qCommands = NULL;
 
-menu_path_t steckPath[CONFIG_MAX_DEPTH_PATH];
-menu_path_t path;
-uint8_t depth = 0;
-Navigate_t inputCommand = NAVIGATE_NOTHING;
-void (**show)(menu_path_t *current_menu);
+static menu_ctx_t defaultCtx;
+static menu_ctx_t *contexts = NULL;
+static portMUX_TYPE contextsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Applications still send bare Navigate_t items to qCommands.
+_Static_assert(sizeof(menu_command_t) == sizeof(Navigate_t),
+               "menu_command_t must stay the size of a Navigate_t");
+
+static void SetDefaultQueue(void) { qCommands = defaultCtx.commands; }
+
+static void SetFunction(menu_ctx_t *ctx, TaskHandle_t function) {
+  ctx->function = function;
+  if (ctx == &defaultCtx)
+    tMenuFunction = function;
+}
+
+// A miss rebuilds the least recently used slot, so the last
+// CONFIG_MENU_VIRTUAL_CACHE_SIZE children looked up stay valid whatever
+// their indexes.
+static menu_virtual_entry_t *VirtualChild(menu_virtual_entry_t *cache,
+                                          menu_virtual_t *menu,
+                                          size_t index) {
+  uint32_t generation = __atomic_load_n(&menu->generation, __ATOMIC_RELAXED);
+  menu_virtual_entry_t *entry = NULL;
+  menu_virtual_entry_t *oldest = &cache[0];
+  uint32_t last = 0;
+
+  for (size_t i = 0; i < CONFIG_MENU_VIRTUAL_CACHE_SIZE; i++) {
+    menu_virtual_entry_t *slot = &cache[i];
+    if (slot->used > last)
+      last = slot->used;
+    if (slot->menu == menu && slot->generation == generation &&
+        slot->index == index) {
+      entry = slot;
+    } else if (slot->used < oldest->used) {
+      oldest = slot;
+    }
+  }
+
+  if (!entry) {
+    entry = oldest;
+    entry->node = (menu_node_t){.label = entry->label};
+    entry->label[0] = '\0';
+    menu->get_child(menu->arg, index, &entry->node, entry->label,
+                    sizeof(entry->label));
+    entry->index = index;
+    entry->menu = menu;
+    entry->generation = generation;
+  }
+  entry->used = last + 1;
+  return entry;
+}
+
+// Copy a virtual child keeping its label valid when it is in the entry.
+static void CopyEntry(menu_virtual_entry_t *dst,
+                      const menu_virtual_entry_t *src) {
+  *dst = *src;
+  if (src->node.label == src->label)
+    dst->node.label = dst->label;
+}
+
+static menu_node_t *OptionNode(const menu_path_t *path, size_t index) {
+  menu_node_t *menu = path->current_menu;
+
+  if (menu->virtual_menu)
+    return &VirtualChild(path->cache, menu->virtual_menu, index)->node;
+  return &menu->submenus[index];
+}
+
+static void (*OptionFunction(const menu_path_t *path))(void *args) {
+  if (path->tree) {
+    return menu_tree_function(
+        path->tree, menu_tree_child(path->tree, path->current_node,
+                                    path->current_index));
+  }
+  return OptionNode(path, path->current_index)->function;
+}
+
+// Open the selected option of path, a virtual child is copied into opened.
+static void EnterOption(menu_path_t *path, menu_virtual_entry_t *opened) {
+  if (path->tree) {
+    path->current_node = menu_tree_child(path->tree, path->current_node,
+                                         path->current_index);
+  } else if (path->current_menu->virtual_menu) {
+    // The cache entry can be reused by any later lookup, keep a copy.
+    menu_virtual_entry_t *entry = VirtualChild(
+        path->cache, path->current_menu->virtual_menu, path->current_index);
+
+    CopyEntry(opened, entry);
+    path->current_menu = &opened->node;
+  } else {
+    path->current_menu = &path->current_menu->submenus[path->current_index];
+  }
+  path->current_index = 0;
+}
+
+static void Drawn(menu_ctx_t *ctx) {
+#if CONFIG_MENU_LATENCY_LOG
+  int64_t select_time = ctx->select_time;
+  if (select_time >= 0) {
+    ESP_LOGI(TAG, "Select to redraw: %lld us",
+             (long long)(esp_timer_get_time() - select_time));
+    ctx->select_time = -1;
+  }
+#endif
+}
+
+#if CONFIG_MENU_RENDER_TASK
+// Publish the current state for the render task. A newer snapshot replaces
+// one not drawn yet.
+static void Publish(menu_ctx_t *ctx) {
+  bool is_opened = ctx->path.current_menu == &ctx->opened.node;
+
+  taskENTER_CRITICAL(&ctx->snapshot_lock);
+  ctx->snapshot = ctx->path;
+  if (is_opened) {
+    // The copy is replaced by the next SELECT while the frame is drawn.
+    CopyEntry(&ctx->snapshot_menu, &ctx->opened);
+    ctx->snapshot.current_menu = &ctx->snapshot_menu.node;
+  }
+  ctx->snapshot_pending = true;
+  // A command whose state was never drawn is traced without a frame.
+  menu_trace_done(ctx, &ctx->snapshot_trace, false);
+  menu_trace_move(&ctx->snapshot_trace, &ctx->trace_record);
+  taskEXIT_CRITICAL(&ctx->snapshot_lock);
+
+  xTaskNotifyGive(ctx->render_task);
+}
 
-static void NavigationUp(bool loop) {
-  ESP_LOGI(TAG, "Command UP");
+// A starting function owns the display: drop the snapshot not drawn yet and
+// wait for the frame being drawn.
+static void DropFrames(menu_ctx_t *ctx) {
+  taskENTER_CRITICAL(&ctx->snapshot_lock);
+  ctx->snapshot_pending = false;
+  menu_trace_done(ctx, &ctx->snapshot_trace, false);
+  taskEXIT_CRITICAL(&ctx->snapshot_lock);
+
+  xEventGroupWaitBits(ctx->events, RENDER_IDLE_BIT, pdFALSE, pdTRUE,
+                      portMAX_DELAY);
+}
+
+static void RenderTask(void *args) {
+  menu_ctx_t *ctx = (menu_ctx_t *)args;
+  const TickType_t period = pdMS_TO_TICKS(1000 / CONFIG_MENU_RENDER_MAX_FPS);
+  TickType_t last = xTaskGetTickCount() - period;
+  menu_virtual_entry_t menu;
+  menu_path_t path;
+#if CONFIG_MENU_TRACE
+  menu_trace_record_t trace;
+#endif
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-  if (path.current_index < path.current_menu->num_options - 1 || loop) {
-    path.current_index++;
-    path.current_index %= path.current_menu->num_options;
+    TickType_t elapsed = xTaskGetTickCount() - last;
+    if (elapsed < period) {
+      vTaskDelay(period - elapsed);
+      // Snapshots published meanwhile are covered by this frame.
+      ulTaskNotifyTake(pdTRUE, 0);
+    }
+    last = xTaskGetTickCount();
+
+    // Cleared before the snapshot is taken, so DropFrames() either removes
+    // it first or waits for this frame.
+    xEventGroupClearBits(ctx->events, RENDER_IDLE_BIT);
+    taskENTER_CRITICAL(&ctx->snapshot_lock);
+    bool pending = ctx->snapshot_pending;
+    ctx->snapshot_pending = false;
+    path = ctx->snapshot;
+    if (path.current_menu == &ctx->snapshot_menu.node) {
+      CopyEntry(&menu, &ctx->snapshot_menu);
+      path.current_menu = &menu.node;
+    }
+    menu_trace_move(&trace, &ctx->snapshot_trace);
+    taskEXIT_CRITICAL(&ctx->snapshot_lock);
+
+    if (pending) {
+      // Virtual children of the frame are built apart from the menu task.
+      path.cache = ctx->render_cache;
+      ctx->config->display(&path);
+      menu_trace_done(ctx, &trace, true);
+      Drawn(ctx);
+    }
+    xEventGroupSetBits(ctx->events, RENDER_IDLE_BIT);
   }
 }
 
-static void NavigationDown(bool loop) {
-  ESP_LOGI(TAG, "Command DOWN");
+static esp_err_t StartRender(menu_ctx_t *ctx) {
+  xEventGroupSetBits(ctx->events, RENDER_IDLE_BIT);
+#if !CONFIG_MENU_NO_HEAP
+  if (!ctx->buffers) {
+    if (xTaskCreate(RenderTask, "menu_render", CONFIG_MENU_RENDER_TASK_STACK,
+                    ctx, CONFIG_MENU_RENDER_TASK_PRIORITY,
+                    &ctx->render_task) != pdPASS) {
+      ctx->render_task = NULL;
+      return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+  }
+#endif
+  ctx->render_task = xTaskCreateStatic(
+      RenderTask, "menu_render", CONFIG_MENU_RENDER_TASK_STACK, ctx,
+      CONFIG_MENU_RENDER_TASK_PRIORITY, ctx->buffers->render_stack,
+      &ctx->buffers->render);
+  return ctx->render_task ? ESP_OK : ESP_FAIL;
+}
+#endif
+
+static void Redraw(menu_ctx_t *ctx) {
+#if CONFIG_MENU_RENDER_TASK
+  // Without render task, before menu_ctx_run() or when it could not start,
+  // the caller draws.
+  if (ctx->render_task) {
+    Publish(ctx);
+    return;
+  }
+#endif
+  ctx->config->display(&ctx->path);
+  menu_trace_done(ctx, &ctx->trace_record, true);
+  Drawn(ctx);
+}
+
+static int32_t CoalesceMoves(menu_ctx_t *ctx, Navigate_t first) {
+  int32_t delta = first == NAVIGATE_UP ? 1 : -1;
+  uint32_t count = 1;
+  menu_command_t next;
+
+  // Everything queued while the last redraw ran becomes one move.
+  while (xQueuePeek(ctx->commands, &next, 0) == pdTRUE &&
+         (next.command == NAVIGATE_UP || next.command == NAVIGATE_DOWN)) {
+    xQueueReceive(ctx->commands, &next, 0);
+    delta += next.command == NAVIGATE_UP ? 1 : -1;
+    count++;
+  }
+
+  ctx->merged += count - 1;
+  if (count > 1) {
+    ESP_LOGD(TAG, "Merged %lu commands, delta %ld", (unsigned long)count,
+             (long)delta);
+  }
 
-  if (path.current_index > 0 || loop) {
-    path.current_index =
-        (path.current_menu->num_options + path.current_index - 1) %
-        path.current_menu->num_options;
+#if CONFIG_MENU_ENCODER_ACCEL
+  int64_t now = esp_timer_get_time();
+  if (now - ctx->last_move > CONFIG_MENU_ENCODER_ACCEL_INTERVAL_MS * 1000LL) {
+    ctx->accel_streak = 0;
   }
+  ctx->last_move = now;
+  ctx->accel_streak += count;
+
+  int32_t step = 1 + ctx->accel_streak / CONFIG_MENU_ENCODER_ACCEL_STREAK;
+  if (step > CONFIG_MENU_ENCODER_ACCEL_MAX)
+    step = CONFIG_MENU_ENCODER_ACCEL_MAX;
+  delta *= step;
+#endif
+
+  return delta;
 }
 
-static void ExecFunction() {
+static void NavigationMove(menu_ctx_t *ctx, int32_t delta) {
+  ESP_LOGI(TAG, "Command %s %ld", delta > 0 ? "UP" : "DOWN", (long)delta);
+
+  int32_t options = menu_path_num_options(&ctx->path);
+  if (options == 0)
+    return;
+
+  int32_t index = ctx->path.current_index + delta;
+  if (ctx->config->loop) {
+    index %= options;
+    if (index < 0)
+      index += options;
+  } else if (index < 0) {
+    index = 0;
+  } else if (index >= options) {
+    index = options - 1;
+  }
+  ctx->path.current_index = index;
+}
+
+static esp_err_t StartFunction(menu_ctx_t *ctx,
+                               void (*function)(void *args)) {
+  // ctx->function tracks one task, a second one would orphan the first.
+  if (ctx->function) {
+    ESP_LOGE(TAG, "A function of this menu already runs");
+    return ESP_ERR_INVALID_STATE;
+  }
+#if CONFIG_MENU_RENDER_TASK
+  if (ctx->render_task)
+    DropFrames(ctx);
+#endif
+  xEventGroupClearBits(ctx->events, FUNCTION_DONE_BIT);
+
+#if !CONFIG_MENU_NO_HEAP
+  if (!ctx->buffers) {
+    // FreeRTOS writes the handle before the task can run, so the function
+    // can find ctx->function as soon as it starts.
+    xTaskCreatePinnedToCore(function, "Function_by_menu",
+                            CONFIG_MENU_FUNCTION_STACK, ctx, 10,
+                            &ctx->function, FUNCTION_CORE);
+    SetFunction(ctx, ctx->function);
+    return ESP_OK;
+  }
+#endif
+
+  // The handle of a static task is its buffer, set before the task can run.
+  SetFunction(ctx, (TaskHandle_t)&ctx->buffers->function);
+  xTaskCreateStaticPinnedToCore(function, "Function_by_menu",
+                                CONFIG_MENU_FUNCTION_STACK, ctx, 10,
+                                ctx->buffers->function_stack,
+                                &ctx->buffers->function, FUNCTION_CORE);
+  return ESP_OK;
+}
+
+static void StopFunction(menu_ctx_t *ctx) {
+  if (ctx->buffers) {
+    // Deleting a task running on the other core is finished later by the
+    // idle task, too late to reuse its buffer. Stop it first.
+    vTaskSuspend(ctx->function);
+    while (eTaskGetState(ctx->function) == eRunning)
+      vTaskDelay(1);
+  }
+  vTaskDelete(ctx->function);
+  SetFunction(ctx, NULL);
+}
+
+static void ExecFunction(menu_ctx_t *ctx) {
   ESP_LOGI(TAG, "Execute Function: %s",
-           path.current_menu->submenus[path.current_index].label);
+           menu_path_option_label(&ctx->path, ctx->path.current_index));
 
-  xTaskCreatePinnedToCore(
-      path.current_menu->submenus[path.current_index].function,
-      "Function_by_menu", 10240, NULL, 10, &tMenuFunction, 1);
+  StartFunction(ctx, OptionFunction(&ctx->path));
 }
 
-static void SelectionOption() {
+static void NotifyChange(menu_value_t *value, bool force) {
+  if (!value->on_change)
+    return;
+
+  int64_t now = esp_timer_get_time();
+  if (!force && value->min_interval_ms &&
+      now - value->last_change < value->min_interval_ms * 1000LL) {
+    value->pending = true;
+    return;
+  }
+
+  value->pending = false;
+  value->last_change = now;
+  value->on_change(value, value->arg);
+}
+
+// Time the menu can block before a rate limited on_change is due.
+static TickType_t PendingWait(menu_ctx_t *ctx) {
+  menu_value_t *value = ctx->editing;
+
+  if (!value || !value->pending)
+    return portMAX_DELAY;
+
+  int64_t due = value->last_change + value->min_interval_ms * 1000LL -
+                esp_timer_get_time();
+  if (due <= 0)
+    return 0;
+  return pdMS_TO_TICKS(due / 1000) + 1;
+}
+
+static void SetEditing(menu_ctx_t *ctx, menu_value_t *value) {
+  if (ctx->editing && ctx->editing->pending)
+    NotifyChange(ctx->editing, true);
+  ctx->editing = value;
+  ctx->path.editing = value != NULL;
+}
+
+static void EditValue(menu_ctx_t *ctx, int32_t delta) {
+  menu_value_t *value = ctx->editing;
+  int32_t step = value->step ? value->step : 1;
+  int64_t number = (int64_t)*value->number + (int64_t)delta * step;
+
+  ESP_LOGI(TAG, "Command EDIT %ld", (long)delta);
+
+  if (value->type == MENU_VALUE_ENUM) {
+    int64_t options = (int64_t)value->max - value->min + 1;
+    number = (number - value->min) % options;
+    if (number < 0)
+      number += options;
+    number += value->min;
+  } else if (number < value->min) {
+    number = value->min;
+  } else if (number > value->max) {
+    number = value->max;
+  }
+
+  if (number != *value->number) {
+    *value->number = number;
+    NotifyChange(value, false);
+  }
+}
+
+static void SelectValue(menu_ctx_t *ctx, menu_value_t *value) {
+  if (value->read_only) {
+    return;
+  } else if (value->type == MENU_VALUE_TOGGLE) {
+    ESP_LOGI(TAG, "Command TOGGLE");
+    *value->flag = !*value->flag;
+    NotifyChange(value, true);
+  } else {
+    ESP_LOGI(TAG, "Edit Value");
+    SetEditing(ctx, value);
+  }
+}
+
+static void RootPath(menu_ctx_t *ctx) {
+  ctx->path = (menu_path_t){
+      .current_menu = ctx->config->tree ? NULL : &ctx->config->root,
+      .current_index = 0,
+      .current_node = 0,
+      .tree = ctx->config->tree,
+      .cache = ctx->cache,
+  };
+  ctx->depth = 0;
+}
+
+#if !CONFIG_MENU_NO_HEAP
+// Move the path stack to a heap block twice its size, up to the levels
+// CONFIG_MAX_DEPTH_PATH allows.
+static esp_err_t GrowStack(menu_ctx_t *ctx) {
+  size_t size = (size_t)ctx->stack_size * 2;
+  if (size > CONFIG_MAX_DEPTH_PATH - 1)
+    size = CONFIG_MAX_DEPTH_PATH - 1;
+
+  menu_path_entry_t *stack = malloc(size * sizeof(menu_path_entry_t));
+  if (!stack)
+    return ESP_ERR_NO_MEM;
+
+  memcpy(stack, ctx->stack, ctx->depth * sizeof(menu_path_entry_t));
+  if (ctx->stack != ctx->stack_inline)
+    free(ctx->stack);
+  ctx->stack = stack;
+  ctx->stack_size = size;
+  return ESP_OK;
+}
+
+// Give the heap block back once the path is down to half the inline levels,
+// so a menu at the edge does not allocate on every SELECT.
+static void ShrinkStack(menu_ctx_t *ctx) {
+  if (ctx->buffers || ctx->stack == ctx->stack_inline ||
+      ctx->depth > CONFIG_MENU_PATH_STACK_INLINE / 2) {
+    return;
+  }
+  memcpy(ctx->stack_inline, ctx->stack,
+         ctx->depth * sizeof(menu_path_entry_t));
+  free(ctx->stack);
+  ctx->stack = ctx->stack_inline;
+  ctx->stack_size = CONFIG_MENU_PATH_STACK_INLINE;
+}
+#else
+// Static menus hold every level CONFIG_MAX_DEPTH_PATH allows.
+static esp_err_t GrowStack(menu_ctx_t *ctx) { return ESP_ERR_NO_MEM; }
+static void ShrinkStack(menu_ctx_t *ctx) {}
+#endif
+
+// The option at the index kept by entry still has the same label.
+static bool SameOption(const menu_path_t *path,
+                       const menu_path_entry_t *entry) {
+  return entry->index < menu_path_num_options(path) &&
+         entry->check == menu_persist_check(
+                             menu_path_option_label(path, entry->index));
+}
+
+static esp_err_t SelectionOption(menu_ctx_t *ctx) {
+  esp_err_t err = ESP_OK;
+
+  if (ctx->depth + 1 >= CONFIG_MAX_DEPTH_PATH) {
+    err = ESP_ERR_INVALID_SIZE;
+  } else if (ctx->depth == ctx->stack_size) {
+    err = GrowStack(ctx);
+  }
+  if (err != ESP_OK) {
+    // The menu stays on this level, redrawn unchanged.
+    ctx->path_overflows++;
+    ESP_LOGW(TAG, "Submenu not opened at depth %u: %s", ctx->depth,
+             esp_err_to_name(err));
+    return err;
+  }
+
   ESP_LOGI(TAG, "Open Submenu");
 
-  path.current_menu = &path.current_menu->submenus[path.current_index];
-  path.current_index = 0;
-  depth++;
-  steckPath[depth] = path;
+  // Keep the selected index of this level for BACK.
+  ctx->stack[ctx->depth] = (menu_path_entry_t){
+      .node = ctx->path.current_node,
+      .index = ctx->path.current_index,
+      .check = ctx->config->tree
+                   ? 0
+                   : menu_persist_check(menu_path_option_label(
+                         &ctx->path, ctx->path.current_index)),
+  };
+  ctx->depth++;
+  EnterOption(&ctx->path, &ctx->opened);
+  return ESP_OK;
 }
 
-static void NavigationBack() {
+static void NavigationBack(menu_ctx_t *ctx) {
+  uint16_t index;
+
   ESP_LOGI(TAG, "Command BACK");
 
-  depth--;
-  path = steckPath[depth];
+  ctx->depth--;
+  if (ctx->config->tree) {
+    const menu_path_entry_t *entry = &ctx->stack[ctx->depth];
+    ctx->path = (menu_path_t){
+        .current_node = entry->node,
+        .tree = ctx->config->tree,
+        .cache = ctx->cache,
+    };
+    index = entry->index;
+  } else {
+    // Only indexes are kept, open the levels above again from root. The
+    // first level whose option changed, as a virtual list can, is shown
+    // from its first option.
+    uint8_t depth = ctx->depth;
+    RootPath(ctx);
+    while (ctx->depth < depth &&
+           SameOption(&ctx->path, &ctx->stack[ctx->depth])) {
+      ctx->path.current_index = ctx->stack[ctx->depth].index;
+      EnterOption(&ctx->path, &ctx->opened);
+      ctx->depth++;
+    }
+    index = ctx->stack[ctx->depth].index;
+    if (!SameOption(&ctx->path, &ctx->stack[ctx->depth])) {
+      ESP_LOGW(TAG, "Menu changed at level %u", ctx->depth);
+      index = 0;
+    }
+  }
+  ShrinkStack(ctx);
+  ctx->path.current_index = index;
 #if !CONFIG_SALVE_INDEX
-  path.current_index = 0;
+  ctx->path.current_index = 0;
 #endif
 }
 
-void menu_init(void *args) {
-  ESP_LOGI(TAG, "Start menu");
-  menu_config_t *params = (menu_config_t *)args;
+static void GotoEntry(menu_ctx_t *ctx, uint16_t target) {
+  const menu_index_t *index = ctx->index;
+  uint16_t chain[CONFIG_MAX_DEPTH_PATH];
+  uint8_t levels = 0;
+
+  if (!index || target >= index->num_entries) {
+    ESP_LOGW(TAG, "Command GOTO to unknown entry %u", target);
+    return;
+  }
+
+  for (uint16_t entry = target; entry != 0;
+       entry = index->entries[entry].parent) {
+    chain[levels++] = entry;
+  }
+
+  ESP_LOGI(TAG, "Command GOTO depth %u", levels);
+  RootPath(ctx);
+  ShrinkStack(ctx);
+  while (levels--) {
+    ctx->path.current_index = index->entries[chain[levels]].index;
+    // A function or a value is selected, not opened, as in RestorePath().
+    if ((levels == 0 &&
+         (OptionFunction(&ctx->path) ||
+          menu_path_option_value(&ctx->path, ctx->path.current_index))) ||
+        SelectionOption(ctx) != ESP_OK) {
+      break;
+    }
+  }
+}
 
-  qCommands = xQueueCreate(10, sizeof(Navigate_t));
+#if CONFIG_MENU_PERSIST
+static void SavedRecord(menu_ctx_t *ctx, menu_persist_record_t *record) {
+  menu_virtual_entry_t opened;
+  menu_path_t path = {
+      .current_menu = ctx->config->tree ? NULL : &ctx->config->root,
+      .tree = ctx->config->tree,
+      .cache = ctx->cache,
+  };
 
-  path.current_index = 0;
-  path.current_menu = &params->root;
-  steckPath[depth] = path;
+  // Walk down from root, the stack keeps only the selected indexes.
+  record->levels = ctx->depth + 1;
+  for (uint8_t level = 0; level < record->levels; level++) {
+    if (level < ctx->depth) {
+      path.current_index = ctx->stack[level].index;
+    } else {
+      path = ctx->path;
+    }
+    record->level[level].index = path.current_index;
+    record->level[level].check =
+        menu_path_num_options(&path) > path.current_index
+            ? menu_persist_check(
+                  menu_path_option_label(&path, path.current_index))
+            : 0;
+    if (level < ctx->depth)
+      EnterOption(&path, &opened);
+  }
+}
+
+// Reopen the saved levels as long as they still match the tree. A level
+// whose option moved or was removed stays closed at index 0.
+static void RestorePath(menu_ctx_t *ctx) {
+  menu_persist_record_t record;
+
+  if (!ctx->config->persist_key)
+    return;
+
+  esp_err_t err = menu_persist_load(ctx->config->persist_key, &record);
+  if (err != ESP_OK) {
+    if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGW(TAG, "Saved position of %s dropped: %s",
+               ctx->config->persist_key, esp_err_to_name(err));
+    }
+    return;
+  }
+  ctx->persist_saved = menu_persist_hash(&record);
+
+  RootPath(ctx);
+  for (uint8_t level = 0; level < record.levels; level++) {
+    const menu_persist_level_t *saved = &record.level[level];
+    if (saved->index >= menu_path_num_options(&ctx->path) ||
+        saved->check != menu_persist_check(menu_path_option_label(
+                            &ctx->path, saved->index))) {
+      ESP_LOGW(TAG, "Saved position of %s stale at level %u",
+               ctx->config->persist_key, level);
+      ctx->path.current_index = 0;
+      break;
+    }
+
+    ctx->path.current_index = saved->index;
+    if (level + 1 == record.levels ||
+        menu_path_option_value(&ctx->path, saved->index) ||
+        OptionFunction(&ctx->path) || SelectionOption(ctx) != ESP_OK) {
+      break;
+    }
+  }
+  ESP_LOGI(TAG, "Restored %s at depth %u", ctx->config->persist_key,
+           ctx->depth);
+}
+
+// Write the position once the menu is idle, skipping unchanged records.
+static void SavePath(menu_ctx_t *ctx) {
+  menu_persist_record_t record;
+
+  if (!ctx->persist_due || esp_timer_get_time() < ctx->persist_due)
+    return;
+  ctx->persist_due = 0;
+
+  SavedRecord(ctx, &record);
+  uint32_t hash = menu_persist_hash(&record);
+  if (hash != ctx->persist_saved &&
+      menu_persist_save(ctx->config->persist_key, &record) == ESP_OK) {
+    ctx->persist_saved = hash;
+  }
+}
+
+static void PathChanged(menu_ctx_t *ctx) {
+  // Every command pushes the write back, a scroll through a list is one.
+  if (ctx->config->persist_key) {
+    ctx->persist_due =
+        esp_timer_get_time() + CONFIG_MENU_PERSIST_DELAY_MS * 1000LL;
+  }
+}
+#endif
+
+// Reload the values the current menu shows, in the task that edits them.
+static void RefreshValues(menu_ctx_t *ctx) {
+  menu_node_t *menu = ctx->path.current_menu;
+
+  if (ctx->path.tree || menu->virtual_menu)
+    return;
+  for (size_t i = 0; i < menu->num_options; i++) {
+    menu_value_t *value = menu->submenus[i].value;
+    if (value && value->refresh && value != ctx->editing)
+      value->refresh(value, value->arg);
+  }
+}
+
+// Time the menu can block before a held back on_change or a save is due.
+static TickType_t IdleWait(menu_ctx_t *ctx) {
+  TickType_t wait = PendingWait(ctx);
+
+#if CONFIG_MENU_PERSIST
+  if (ctx->persist_due) {
+    int64_t due = ctx->persist_due - esp_timer_get_time();
+    TickType_t save = due <= 0 ? 0 : pdMS_TO_TICKS(due / 1000) + 1;
+    if (save < wait)
+      wait = save;
+  }
+#endif
+  return wait;
+}
+
+const char *menu_path_title(const menu_path_t *path) {
+  if (path->tree)
+    return menu_tree_label(path->tree, path->current_node);
+  return path->current_menu->label;
+}
+
+size_t menu_path_num_options(const menu_path_t *path) {
+  if (path->tree)
+    return menu_tree_num_children(path->tree, path->current_node);
+  if (path->current_menu->virtual_menu) {
+    menu_virtual_t *menu = path->current_menu->virtual_menu;
+    size_t count = menu->count(menu->arg);
+    // current_index is 16 bit, the rest of a longer list is not reachable.
+    return count > UINT16_MAX ? UINT16_MAX : count;
+  }
+  return path->current_menu->num_options;
+}
+
+const char *menu_path_option_label(const menu_path_t *path, size_t index) {
+  if (path->tree) {
+    return menu_tree_label(path->tree,
+                           menu_tree_child(path->tree, path->current_node,
+                                           index));
+  }
+  return OptionNode(path, index)->label;
+}
+
+menu_value_t *menu_path_option_value(const menu_path_t *path, size_t index) {
+  if (path->tree)
+    return NULL;
+  return OptionNode(path, index)->value;
+}
+
+int menu_value_format(const menu_value_t *value, char *buf, size_t size) {
+  switch (value->type) {
+  case MENU_VALUE_TOGGLE:
+    return snprintf(buf, size, "%s", *value->flag ? "ON" : "OFF");
+
+  case MENU_VALUE_ENUM: {
+    // The bound variable can be set outside the menu, keep it in options.
+    int32_t number = *value->number;
+    if (number < value->min)
+      number = value->min;
+    else if (number > value->max)
+      number = value->max;
+    return snprintf(buf, size, "%s", value->options[number - value->min]);
+  }
+
+  case MENU_VALUE_FIXED:
+    if (value->decimals) {
+      int32_t scale = 1;
+      for (uint8_t i = 0; i < value->decimals; i++)
+        scale *= 10;
+      int64_t number = *value->number;
+      const char *sign = number < 0 ? "-" : "";
+      if (number < 0)
+        number = -number;
+      return snprintf(buf, size, "%s%ld.%0*ld", sign, (long)(number / scale),
+                      value->decimals, (long)(number % scale));
+    }
+    // fall through
+
+  default:
+    return snprintf(buf, size, "%ld", (long)*value->number);
+  }
+}
 
-  show = &params->display;
-  (*show)(&path);
+void menu_virtual_invalidate(menu_virtual_t *menu) {
+  // Entries of an older generation are built again on their next lookup.
+  __atomic_fetch_add(&menu->generation, 1, __ATOMIC_RELAXED);
+}
+
+static void InitCtx(menu_ctx_t *ctx, menu_config_t *config) {
+  *ctx = (menu_ctx_t){
+      .config = config,
+      .select_time = -1,
+  };
+  portMUX_INITIALIZE(&ctx->snapshot_lock);
+  ctx->stack = ctx->stack_inline;
+  ctx->stack_size = CONFIG_MENU_PATH_STACK_INLINE;
+  RootPath(ctx);
+}
+
+static void AddCtx(menu_ctx_t *ctx) {
+  taskENTER_CRITICAL(&contextsLock);
+  ctx->next = contexts;
+  contexts = ctx;
+  taskEXIT_CRITICAL(&contextsLock);
+}
+
+#if !CONFIG_MENU_NO_HEAP
+esp_err_t menu_ctx_create(menu_ctx_t *ctx, menu_config_t *config) {
+  if (!ctx || !config || !config->display)
+    return ESP_ERR_INVALID_ARG;
+
+  InitCtx(ctx, config);
+
+#if CONFIG_MENU_PATH_INDEX
+  ctx->index = calloc(1, sizeof(menu_index_t));
+  if (!ctx->index || menu_index_build(ctx->index, &ctx->path) != ESP_OK) {
+    ESP_LOGE(TAG, "No memory for path index");
+    free(ctx->index);
+    ctx->index = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+#endif
+
+  ctx->commands =
+      xQueueCreate(MENU_COMMAND_QUEUE_LENGTH, sizeof(menu_command_t));
+  ctx->events = xEventGroupCreate();
+  if (!ctx->commands || !ctx->events) {
+    ESP_LOGE(TAG, "No memory for menu");
+    if (ctx->commands)
+      vQueueDelete(ctx->commands);
+    if (ctx->events)
+      vEventGroupDelete(ctx->events);
+    if (ctx->index) {
+      menu_index_free(ctx->index);
+      free(ctx->index);
+      ctx->index = NULL;
+    }
+    return ESP_ERR_NO_MEM;
+  }
+
+  AddCtx(ctx);
+  return ESP_OK;
+}
+#endif
 
-  ESP_LOGI(TAG, "Root Title: %s", path.current_menu->label);
+esp_err_t menu_ctx_create_static(menu_ctx_t *ctx, menu_config_t *config,
+                                 menu_ctx_static_t *buffers) {
+  if (!ctx || !config || !config->display || !buffers)
+    return ESP_ERR_INVALID_ARG;
+
+  InitCtx(ctx, config);
+  ctx->buffers = buffers;
+  ctx->stack = buffers->stack;
+  ctx->stack_size = CONFIG_MAX_DEPTH_PATH - 1;
+  ctx->commands = xQueueCreateStatic(MENU_COMMAND_QUEUE_LENGTH,
+                                     sizeof(menu_command_t),
+                                     buffers->command_storage,
+                                     &buffers->commands);
+  ctx->events = xEventGroupCreateStatic(&buffers->events);
+
+  AddCtx(ctx);
+  return ESP_OK;
+}
+
+void menu_ctx_run(void *args) {
+  menu_ctx_t *ctx = (menu_ctx_t *)args;
+  menu_command_t item;
+  Navigate_t inputCommand;
+
+#if CONFIG_MENU_PERSIST
+  RestorePath(ctx);
+#endif
+  ESP_LOGI(TAG, "Root Title: %s", menu_path_title(&ctx->path));
+#if CONFIG_MENU_RENDER_TASK
+  if (StartRender(ctx) != ESP_OK)
+    ESP_LOGE(TAG, "No render task, the menu task draws");
+#endif
+  Redraw(ctx);
 
   while (true) {
 
-    xQueueReceive(qCommands, &inputCommand, portMAX_DELAY);
+    if (xQueueReceive(ctx->commands, &item, IdleWait(ctx)) != pdTRUE) {
+      // Deliver the last value held back by min_interval_ms.
+      if (ctx->editing && ctx->editing->pending)
+        NotifyChange(ctx->editing, true);
+#if CONFIG_MENU_PERSIST
+      SavePath(ctx);
+#endif
+      continue;
+    }
+    menu_trace_dequeued(ctx, &item);
+    inputCommand = (Navigate_t)item.command;
 
-    if (tMenuFunction == NULL) {
+#if CONFIG_MENU_LATENCY_LOG
+    if (inputCommand == NAVIGATE_SELECT && ctx->function == NULL) {
+      ctx->select_time = esp_timer_get_time();
+    }
+#endif
+
+    if (ctx->function == NULL) {
 
       switch (inputCommand) {
 
       case NAVIGATE_UP:
-        NavigationUp(params->loop);
-        break;
-
       case NAVIGATE_DOWN:
-        NavigationDown(params->loop);
+        if (ctx->editing) {
+          EditValue(ctx, CoalesceMoves(ctx, inputCommand));
+        } else {
+          NavigationMove(ctx, CoalesceMoves(ctx, inputCommand));
+        }
         break;
 
       case NAVIGATE_SELECT:
-        if (path.current_menu->submenus[path.current_index].function) {
-          ExecFunction();
+        if (ctx->editing) {
+          SetEditing(ctx, NULL);
+        } else if (menu_path_num_options(&ctx->path) == 0) {
+          break;
+        } else if (menu_path_option_value(&ctx->path,
+                                          ctx->path.current_index)) {
+          SelectValue(ctx, menu_path_option_value(&ctx->path,
+                                                  ctx->path.current_index));
+        } else if (OptionFunction(&ctx->path)) {
+          ExecFunction(ctx);
         } else {
-          SelectionOption();
+          SelectionOption(ctx);
         }
         break;
 
       case NAVIGATE_BACK:
-        if (depth) {
-          NavigationBack();
+        if (ctx->editing) {
+          SetEditing(ctx, NULL);
+        } else if (ctx->depth) {
+          NavigationBack(ctx);
         }
         break;
 
+      case NAVIGATE_GOTO:
+        SetEditing(ctx, NULL);
+        GotoEntry(ctx, item.arg);
+        break;
+
+      case NAVIGATE_REFRESH:
+        RefreshValues(ctx);
+        break;
+
+      case NAVIGATE_FUNCTION_DONE:
+        // Stale completion of a function already aborted by BACK.
+        menu_trace_done(ctx, &ctx->trace_record, false);
+        continue;
+
       default:
         ESP_LOGW(TAG, "Undenfined Input");
         break;
       }
 
-    } else if (inputCommand == NAVIGATE_BACK) {
-      vTaskDelete(tMenuFunction);
-      tMenuFunction = NULL;
+    } else if (inputCommand == NAVIGATE_BACK ||
+               inputCommand == NAVIGATE_FUNCTION_DONE) {
+      StopFunction(ctx);
+      xEventGroupSetBits(ctx->events, FUNCTION_DONE_BIT);
       ESP_LOGI(TAG, "Exit Function");
     }
-    if (tMenuFunction == NULL)
-      (*show)(&path);
+    menu_trace_changed(ctx);
+#if CONFIG_MENU_PERSIST
+    if (inputCommand != NAVIGATE_REFRESH)
+      PathChanged(ctx);
+#endif
+    if (ctx->function == NULL) {
+      Redraw(ctx);
+    } else {
+      // A function started or ignored the command, no frame follows.
+      menu_trace_done(ctx, &ctx->trace_record, false);
+    }
   }
 }
 
-void exitFunction(void) {
-  Navigate_t tempCommand = NAVIGATE_BACK;
-  xQueueSend(qCommands, &tempCommand, portMAX_DELAY);
-  vTaskDelay(1000 / portTICK_PERIOD_MS);
+static esp_err_t Send(menu_ctx_t *ctx, menu_command_t item, TickType_t wait) {
+#if CONFIG_MENU_TRACE
+  menu_trace_stamp(ctx, &item);
+#endif
+  if (xQueueSend(ctx->commands, &item, wait) != pdTRUE)
+    return ESP_ERR_TIMEOUT;
+  return ESP_OK;
 }
 
-void execFunction(void (*function)(void *args)) {
+esp_err_t menu_ctx_send(menu_ctx_t *ctx, Navigate_t command, TickType_t wait) {
+  return Send(ctx, (menu_command_t){.command = command}, wait);
+}
+
+esp_err_t menu_ctx_goto(menu_ctx_t *ctx, const char *path, TickType_t wait) {
+  if (!ctx->index)
+    return ESP_ERR_NOT_SUPPORTED;
+
+  menu_path_t root = {
+      .current_menu = ctx->config->tree ? NULL : &ctx->config->root,
+      .tree = ctx->config->tree,
+  };
+  uint16_t entry = menu_index_find(ctx->index, &root, path);
+  if (entry == MENU_INDEX_NONE)
+    return ESP_ERR_NOT_FOUND;
+
+  // The entry travels with the command, concurrent gotos cannot mix up.
+  return Send(ctx, (menu_command_t){.command = NAVIGATE_GOTO, .arg = entry},
+              wait);
+}
+
+void menu_ctx_exit_function(menu_ctx_t *ctx) {
+  if (!ctx || xTaskGetCurrentTaskHandle() != ctx->function) {
+    // The caller expects not to return, end it like the task it should be.
+    ESP_LOGE(TAG, "exitFunction() outside a function started by a menu");
+    vTaskDelete(NULL);
+  }
+
+  menu_command_t tempCommand = {.command = NAVIGATE_FUNCTION_DONE};
+  xQueueSend(ctx->commands, &tempCommand, portMAX_DELAY);
+  // The menu deletes this task as soon as it dequeues the command.
+  vTaskSuspend(NULL);
+}
+
+void menu_ctx_exec_function(menu_ctx_t *ctx, void (*function)(void *args)) {
   ESP_LOGI(TAG, "Execute Function");
 
-  xTaskCreatePinnedToCore(function, "Function_by_menu", 10240, NULL, 10,
-                          &tMenuFunction, 1);
-  vTaskDelay(1000 / portTICK_PERIOD_MS);
+#if CONFIG_MENU_LATENCY_LOG
+  int64_t start = esp_timer_get_time();
+#endif
+  if (StartFunction(ctx, function) != ESP_OK)
+    return;
+  xEventGroupWaitBits(ctx->events, FUNCTION_DONE_BIT, pdTRUE, pdTRUE,
+                      portMAX_DELAY);
+#if CONFIG_MENU_LATENCY_LOG
+  ESP_LOGI(TAG, "Exec to return: %lld us",
+           (long long)(esp_timer_get_time() - start));
+#endif
+}
+
+void menu_ctx_redraw(menu_ctx_t *ctx) { Redraw(ctx); }
+
+#if !CONFIG_MENU_NO_HEAP
+void menu_init(void *args) {
+  ESP_LOGI(TAG, "Start menu");
+
+  ESP_ERROR_CHECK(menu_ctx_create(&defaultCtx, (menu_config_t *)args));
+  SetDefaultQueue();
+  menu_ctx_run(&defaultCtx);
+}
+#endif
+
+esp_err_t menu_default_ctx_create_static(menu_config_t *config,
+                                         menu_ctx_static_t *buffers) {
+  esp_err_t err = menu_ctx_create_static(&defaultCtx, config, buffers);
+
+  if (err == ESP_OK)
+    SetDefaultQueue();
+  return err;
+}
+
+menu_ctx_t *menu_default_ctx(void) {
+  return defaultCtx.commands ? &defaultCtx : NULL;
+}
+
+esp_err_t menu_send(Navigate_t command) {
+  return menu_ctx_send(&defaultCtx, command, portMAX_DELAY);
+}
+
+esp_err_t menu_goto(const char *path) {
+  return menu_ctx_goto(&defaultCtx, path, portMAX_DELAY);
+}
+
+// Menu running its function in the calling task, NULL when there is none.
+static menu_ctx_t *CallerCtx(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  menu_ctx_t *ctx;
+
+  taskENTER_CRITICAL(&contextsLock);
+  for (ctx = contexts; ctx && ctx->function != self; ctx = ctx->next) {
+  }
+  taskEXIT_CRITICAL(&contextsLock);
+  return ctx;
+}
+
+void exitFunction(void) { menu_ctx_exit_function(CallerCtx()); }
+
+void execFunction(void (*function)(void *args)) {
+  menu_ctx_t *ctx = CallerCtx();
+
+  menu_ctx_exec_function(ctx ? ctx : &defaultCtx, function);
+}
+
+void setQuick_menuFunction(void) {
+  menu_ctx_t *ctx = CallerCtx();
+
+  menu_ctx_redraw(ctx ? ctx : &defaultCtx);
 }
 
-void setQuick_menuFunction(void) { (*show)(&path); }
+uint32_t menu_merged_commands(void) { return defaultCtx.merged; }
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,264 @@
+#include "menu_mirror.h"
+#include "esp_err.h"
+#include "menu_manager.h"
+#include "menu_renderer.h"
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+const static char *TAG = "menu_mirror";
+
+static esp_err_t Put(menu_mirror_t *mirror, const void *data, size_t len,
+                     uint8_t *sum) {
+  const uint8_t *bytes = (const uint8_t *)data;
+
+  for (size_t i = 0; i < len; i++)
+    *sum += bytes[i];
+  mirror->bytes += len;
+  return mirror->config.write(mirror->config.arg, bytes, len);
+}
+
+static esp_err_t Begin(menu_mirror_t *mirror, menu_mirror_packet_t type,
+                       uint16_t len, uint8_t *sum) {
+  const uint8_t sync[2] = {MENU_MIRROR_SYNC0, MENU_MIRROR_SYNC1};
+  const uint8_t header[5] = {type, mirror->seq & 0xFF, mirror->seq >> 8,
+                             len & 0xFF, len >> 8};
+  uint8_t ignored = 0;
+  esp_err_t err = Put(mirror, sync, sizeof(sync), &ignored);
+
+  *sum = 0;
+  if (err == ESP_OK)
+    err = Put(mirror, header, sizeof(header), sum);
+  return err;
+}
+
+static esp_err_t End(menu_mirror_t *mirror, uint8_t sum) {
+  uint8_t ignored = 0;
+
+  mirror->seq++;
+  mirror->packets++;
+  return Put(mirror, &sum, 1, &ignored);
+}
+
+static esp_err_t SendGlyph(menu_mirror_t *mirror, uint8_t slot,
+                           const uint8_t bitmap[8]) {
+  uint8_t sum;
+  esp_err_t err = Begin(mirror, MENU_MIRROR_GLYPH, 9, &sum);
+
+  if (err == ESP_OK)
+    err = Put(mirror, &slot, 1, &sum);
+  if (err == ESP_OK)
+    err = Put(mirror, bitmap, 8, &sum);
+  if (err == ESP_OK)
+    err = End(mirror, sum);
+  return err;
+}
+
+// Whole frame and every cached glyph, straight from what the renderer shows.
+static esp_err_t SendFull(menu_mirror_t *mirror) {
+  const menu_renderer_t *renderer = mirror->config.renderer;
+  const uint8_t size[2] = {renderer->cols, renderer->rows};
+  uint16_t cells = renderer->cols * renderer->rows;
+  esp_err_t err = ESP_OK;
+  uint8_t sum;
+
+  for (uint8_t slot = 0; slot < MENU_RENDERER_GLYPH_SLOTS && err == ESP_OK;
+       slot++) {
+    if (renderer->slots[slot].glyph && mirror->display.upload_glyph)
+      err = SendGlyph(mirror, slot, renderer->slots[slot].glyph->bitmap);
+  }
+
+  if (err == ESP_OK)
+    err = Begin(mirror, MENU_MIRROR_FULL, sizeof(size) + cells, &sum);
+  if (err == ESP_OK)
+    err = Put(mirror, size, sizeof(size), &sum);
+  if (err == ESP_OK)
+    err = Put(mirror, renderer->shown, cells, &sum);
+  if (err == ESP_OK)
+    err = End(mirror, sum);
+  return err;
+}
+
+static esp_err_t SendDelta(menu_mirror_t *mirror) {
+  uint16_t len = 0;
+  esp_err_t err;
+  uint8_t sum;
+
+  for (uint8_t i = 0; i < mirror->num_runs; i++)
+    len += 3 + mirror->runs[i].len;
+
+  err = Begin(mirror, MENU_MIRROR_DELTA, len, &sum);
+  for (uint8_t i = 0; i < mirror->num_runs && err == ESP_OK; i++) {
+    const menu_mirror_run_t *run = &mirror->runs[i];
+    const uint8_t header[3] = {run->row, run->col, run->len};
+
+    err = Put(mirror, header, sizeof(header), &sum);
+    if (err == ESP_OK)
+      err = Put(mirror, run->data, run->len, &sum);
+  }
+  if (err == ESP_OK)
+    err = End(mirror, sum);
+  return err;
+}
+
+static esp_err_t SetCursor(void *ctx, uint8_t col, uint8_t row) {
+  menu_mirror_t *mirror = (menu_mirror_t *)ctx;
+
+  mirror->col = col;
+  mirror->row = row;
+  if (!mirror->display.set_cursor)
+    return ESP_OK;
+  mirror->display_dirty = true;
+  return mirror->display.set_cursor(mirror->display.ctx, col, row);
+}
+
+static esp_err_t Write(void *ctx, const char *data, size_t len) {
+  menu_mirror_t *mirror = (menu_mirror_t *)ctx;
+
+  // The renderer does not touch its frame during a flush, keep pointers.
+  if (mirror->num_runs < CONFIG_MENU_MIRROR_MAX_RUNS) {
+    mirror->runs[mirror->num_runs] = (menu_mirror_run_t){
+        .data = data,
+        .row = mirror->row,
+        .col = mirror->col,
+        .len = len,
+    };
+    mirror->num_runs++;
+  } else {
+    // Too many runs, this flush is sent as a full frame.
+    mirror->num_runs = CONFIG_MENU_MIRROR_MAX_RUNS + 1;
+  }
+  mirror->col += len;
+
+  if (!mirror->display.write)
+    return ESP_OK;
+  mirror->display_dirty = true;
+  return mirror->display.write(mirror->display.ctx, data, len);
+}
+
+static esp_err_t UploadGlyph(void *ctx, uint8_t slot, const uint8_t bitmap[8]) {
+  menu_mirror_t *mirror = (menu_mirror_t *)ctx;
+
+  mirror->glyphs[slot] = bitmap;
+  mirror->display_dirty = true;
+  return mirror->display.upload_glyph(mirror->display.ctx, slot, bitmap);
+}
+
+static esp_err_t Flush(void *ctx) {
+  menu_mirror_t *mirror = (menu_mirror_t *)ctx;
+  esp_err_t err = ESP_OK;
+  esp_err_t sent = ESP_OK;
+
+  if (mirror->display_dirty && mirror->display.flush)
+    err = mirror->display.flush(mirror->display.ctx);
+  mirror->display_dirty = false;
+
+  if (mirror->resync || mirror->num_runs > CONFIG_MENU_MIRROR_MAX_RUNS) {
+    mirror->resync = false;
+    sent = SendFull(mirror);
+  } else {
+    for (uint8_t slot = 0; slot < MENU_RENDERER_GLYPH_SLOTS; slot++) {
+      if (mirror->glyphs[slot] && sent == ESP_OK)
+        sent = SendGlyph(mirror, slot, mirror->glyphs[slot]);
+    }
+    if (mirror->num_runs && sent == ESP_OK)
+      sent = SendDelta(mirror);
+  }
+  mirror->num_runs = 0;
+  memset(mirror->glyphs, 0, sizeof(mirror->glyphs));
+
+  // The display is fine, only the host lost track of the frame.
+  if (sent != ESP_OK) {
+    ESP_LOGW(TAG, "Write error %d, full frame on next flush", sent);
+    mirror->resync = true;
+  }
+  return err;
+}
+
+esp_err_t menu_mirror_init(menu_mirror_t *mirror,
+                           const menu_mirror_config_t *config) {
+  if (!mirror || !config || !config->write || !config->renderer)
+    return ESP_ERR_INVALID_ARG;
+
+  *mirror = (menu_mirror_t){
+      .config = *config,
+      .resync = true,
+  };
+  if (config->display)
+    mirror->display = *config->display;
+  mirror->config.display = &mirror->display;
+  return ESP_OK;
+}
+
+void menu_mirror_backend(menu_mirror_t *mirror,
+                         menu_renderer_backend_t *backend) {
+  *backend = (menu_renderer_backend_t){
+      .ctx = mirror,
+      .set_cursor = SetCursor,
+      .write = Write,
+      .flush = Flush,
+      // Without custom characters on the display the renderer draws the
+      // fallbacks, which a terminal can show too.
+      .upload_glyph = mirror->display.upload_glyph ? UploadGlyph : NULL,
+  };
+}
+
+void menu_mirror_feed(menu_mirror_t *mirror, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = data[i];
+
+    if (mirror->parsed == 0) {
+      if (byte == MENU_MIRROR_COMMAND)
+        mirror->parse[mirror->parsed++] = byte;
+      else
+        mirror->rejected++;
+      continue;
+    }
+
+    mirror->parse[mirror->parsed++] = byte;
+    if (mirror->parsed < sizeof(mirror->parse))
+      continue;
+    mirror->parsed = 0;
+
+    uint8_t command = mirror->parse[1];
+    menu_ctx_t *ctx =
+        mirror->config.ctx ? mirror->config.ctx : menu_default_ctx();
+    if ((command ^ 0xFF) != mirror->parse[2] || !ctx) {
+      mirror->rejected++;
+      continue;
+    }
+
+    switch (command) {
+    case MENU_MIRROR_RESYNC:
+      mirror->resync = true;
+      command = NAVIGATE_REFRESH;
+      break;
+
+    case NAVIGATE_UP:
+    case NAVIGATE_DOWN:
+    case NAVIGATE_SELECT:
+    case NAVIGATE_BACK:
+      break;
+
+    default:
+      mirror->rejected++;
+      continue;
+    }
+
+    if (menu_ctx_send(ctx, (Navigate_t)command, 0) == ESP_OK)
+      mirror->commands++;
+    else
+      mirror->rejected++;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
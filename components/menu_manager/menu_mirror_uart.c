@@ -0,0 +1,68 @@
+#include "menu_mirror.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static esp_err_t UartWrite(void *arg, const uint8_t *data, size_t len) {
+  menu_mirror_t *mirror = (menu_mirror_t *)arg;
+
+  // Blocks only while the driver TX buffer is full.
+  if (uart_write_bytes(mirror->uart, data, len) != (int)len)
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+static void ReceiveTask(void *args) {
+  menu_mirror_t *mirror = (menu_mirror_t *)args;
+  uint8_t data[16];
+
+  while (true) {
+    int len = uart_read_bytes(mirror->uart, data, sizeof(data), portMAX_DELAY);
+    if (len > 0)
+      menu_mirror_feed(mirror, data, len);
+  }
+}
+
+static void SetUart(menu_mirror_t *mirror, int uart) {
+  mirror->uart = uart;
+  mirror->config.write = UartWrite;
+  mirror->config.arg = mirror;
+}
+
+#if !CONFIG_MENU_NO_HEAP
+esp_err_t menu_mirror_uart_start(menu_mirror_t *mirror, int uart) {
+  SetUart(mirror, uart);
+  if (xTaskCreate(ReceiveTask, "menu_mirror", MENU_MIRROR_UART_TASK_STACK,
+                  mirror, CONFIG_MENU_MIRROR_TASK_PRIORITY,
+                  &mirror->task) != pdPASS) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+#endif
+
+esp_err_t menu_mirror_uart_start_static(menu_mirror_t *mirror, int uart,
+                                        menu_mirror_uart_static_t *storage) {
+  if (!storage)
+    return ESP_ERR_INVALID_ARG;
+
+  SetUart(mirror, uart);
+  mirror->task = xTaskCreateStatic(ReceiveTask, "menu_mirror",
+                                   MENU_MIRROR_UART_TASK_STACK, mirror,
+                                   CONFIG_MENU_MIRROR_TASK_PRIORITY,
+                                   storage->stack, &storage->task);
+  return ESP_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,20 @@
+// Heap guard, private to menu_manager and included last by its sources. With
+// CONFIG_MENU_NO_HEAP any allocating call left in them fails the build.
+#pragma once
+#include "sdkconfig.h"
+
+#if CONFIG_MENU_NO_HEAP
+// Function-like macros of FreeRTOS, gone before their names are poisoned.
+#undef xQueueCreate
+#undef xSemaphoreCreateBinary
+#undef xSemaphoreCreateMutex
+#undef xSemaphoreCreateRecursiveMutex
+#undef xSemaphoreCreateCounting
+
+#pragma GCC poison malloc calloc realloc free strdup
+#pragma GCC poison xTaskCreate xTaskCreatePinnedToCore xQueueCreate
+#pragma GCC poison xQueueGenericCreate xSemaphoreCreateBinary
+#pragma GCC poison xSemaphoreCreateMutex xSemaphoreCreateRecursiveMutex
+#pragma GCC poison xSemaphoreCreateCounting xEventGroupCreate xTimerCreate
+#pragma GCC poison esp_timer_create
+#endif
@@ -0,0 +1,116 @@
+#include "menu_persist.h"
+#include "esp_err.h"
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include <nvs.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static uint32_t Hash(uint32_t hash, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint16_t menu_persist_check(const char *label) {
+  uint32_t hash = Hash(FNV_OFFSET, (const uint8_t *)label, strlen(label));
+  return (uint16_t)(hash ^ hash >> 16);
+}
+
+#if CONFIG_MENU_PERSIST
+
+const static char *TAG = "menu_persist";
+
+#define NAMESPACE "menu_manager"
+#define VERSION 1
+#define HEADER_SIZE 2
+#define LEVEL_SIZE 4
+
+uint32_t menu_persist_hash(const menu_persist_record_t *record) {
+  uint32_t hash = Hash(FNV_OFFSET, &record->levels, 1);
+  return Hash(hash, (const uint8_t *)record->level,
+              record->levels * sizeof(record->level[0]));
+}
+
+// Version, levels, then index and check of every level, little endian.
+esp_err_t menu_persist_load(const char *key, menu_persist_record_t *record) {
+  uint8_t blob[HEADER_SIZE + LEVEL_SIZE * (CONFIG_MAX_DEPTH_PATH + 1)];
+  size_t size = sizeof(blob);
+  nvs_handle_t handle;
+
+  esp_err_t err = nvs_open(NAMESPACE, NVS_READONLY, &handle);
+  if (err == ESP_ERR_NVS_NOT_FOUND)
+    return ESP_ERR_NOT_FOUND;
+  if (err != ESP_OK)
+    return err;
+  err = nvs_get_blob(handle, key, blob, &size);
+  nvs_close(handle);
+  if (err == ESP_ERR_NVS_NOT_FOUND)
+    return ESP_ERR_NOT_FOUND;
+  if (err == ESP_ERR_NVS_INVALID_LENGTH)
+    return ESP_ERR_INVALID_VERSION;
+  if (err != ESP_OK)
+    return err;
+
+  // A record of another build, MAX_DEPTH_PATH changed or corrupted.
+  if (size < HEADER_SIZE || blob[0] != VERSION || blob[1] == 0 ||
+      blob[1] > CONFIG_MAX_DEPTH_PATH + 1 ||
+      size != HEADER_SIZE + (size_t)LEVEL_SIZE * blob[1]) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  record->levels = blob[1];
+  for (uint8_t i = 0; i < record->levels; i++) {
+    const uint8_t *level = &blob[HEADER_SIZE + LEVEL_SIZE * i];
+    record->level[i].index = level[0] | level[1] << 8;
+    record->level[i].check = level[2] | level[3] << 8;
+  }
+  return ESP_OK;
+}
+
+esp_err_t menu_persist_save(const char *key,
+                            const menu_persist_record_t *record) {
+  uint8_t blob[HEADER_SIZE + LEVEL_SIZE * (CONFIG_MAX_DEPTH_PATH + 1)];
+  nvs_handle_t handle;
+
+  blob[0] = VERSION;
+  blob[1] = record->levels;
+  for (uint8_t i = 0; i < record->levels; i++) {
+    uint8_t *level = &blob[HEADER_SIZE + LEVEL_SIZE * i];
+    level[0] = record->level[i].index;
+    level[1] = record->level[i].index >> 8;
+    level[2] = record->level[i].check;
+    level[3] = record->level[i].check >> 8;
+  }
+
+  esp_err_t err = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK)
+    return err;
+  err = nvs_set_blob(handle, key, blob,
+                     HEADER_SIZE + (size_t)LEVEL_SIZE * record->levels);
+  if (err == ESP_OK)
+    err = nvs_commit(handle);
+  nvs_close(handle);
+
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Saving %s: %s", key, esp_err_to_name(err));
+  return err;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,53 @@
+// Saved menu position, private to menu_manager.
+#pragma once
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <esp_err.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint16_t index;
+  /**< Selected option of the level. */
+  uint16_t check;
+  /**< menu_persist_check() of the label of that option. */
+} menu_persist_level_t;
+
+typedef struct {
+  uint8_t levels;
+  /**< Open submenus + 1, the last level is the current menu. */
+  menu_persist_level_t level[CONFIG_MAX_DEPTH_PATH + 1];
+  /**< Root first. */
+} menu_persist_record_t;
+
+/**
+ * @brief 16 bit hash of a label, tells a level that points to another
+ * option since the tree changed. Also built without CONFIG_MENU_PERSIST,
+ * for the path stack.
+ */
+uint16_t menu_persist_check(const char *label);
+
+/**
+ * @brief Hash of the used part of a record, to skip writing it unchanged.
+ */
+uint32_t menu_persist_hash(const menu_persist_record_t *record);
+
+/**
+ * @brief Read the record saved under key.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND, ESP_ERR_INVALID_VERSION or an NVS error.
+ */
+esp_err_t menu_persist_load(const char *key, menu_persist_record_t *record);
+
+/**
+ * @brief Write and commit a record under key.
+ */
+esp_err_t menu_persist_save(const char *key,
+                            const menu_persist_record_t *record);
+
+#ifdef __cplusplus
+}
+#endif
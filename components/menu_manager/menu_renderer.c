@@ -0,0 +1,466 @@
+#include "menu_renderer.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+const static char *TAG = "menu_renderer";
+
+// Renderers with scrolling text on screen, stepped by one shared timer that
+// runs only while the list is not empty.
+static menu_renderer_t *scrolling_list = NULL;
+static SemaphoreHandle_t scrolling_lock = NULL;
+static StaticSemaphore_t scrolling_lock_buffer;
+#if CONFIG_MENU_NO_HEAP
+// esp_timer allocates its timers, a FreeRTOS timer lives here.
+static TimerHandle_t marquee_timer = NULL;
+static StaticTimer_t marquee_timer_buffer;
+#else
+static esp_timer_handle_t marquee_timer = NULL;
+#endif
+
+static void MarqueeStep(void *arg) {
+  // Timer tasks are shared, never block them: a busy list skips this step.
+  if (xSemaphoreTake(scrolling_lock, 0) != pdTRUE)
+    return;
+  for (menu_renderer_t *renderer = scrolling_list; renderer;
+       renderer = renderer->marquee_next) {
+    renderer->marquee_step++;
+    renderer->marquee_redraw(renderer->marquee_arg);
+  }
+  xSemaphoreGive(scrolling_lock);
+}
+
+#if CONFIG_MENU_NO_HEAP
+static void MarqueeTimer(TimerHandle_t timer) { MarqueeStep(NULL); }
+
+static esp_err_t CreateMarqueeTimer(void) {
+  marquee_timer = xTimerCreateStatic(
+      "menu_marquee", pdMS_TO_TICKS(CONFIG_MENU_RENDERER_MARQUEE_MS), pdTRUE,
+      NULL, MarqueeTimer, &marquee_timer_buffer);
+  return ESP_OK;
+}
+
+// Called with scrolling_lock held, never wait for the timer queue.
+static void StartMarqueeTimer(void) {
+  if (xTimerStart(marquee_timer, 0) != pdPASS)
+    ESP_LOGW(TAG, "Timer queue full, marquee not started");
+}
+
+static void StopMarqueeTimer(void) { xTimerStop(marquee_timer, 0); }
+#else
+static esp_err_t CreateMarqueeTimer(void) {
+  const esp_timer_create_args_t args = {
+      .callback = MarqueeStep,
+      .name = "menu_marquee",
+  };
+  return esp_timer_create(&args, &marquee_timer);
+}
+
+static void StartMarqueeTimer(void) {
+  esp_timer_start_periodic(marquee_timer,
+                           CONFIG_MENU_RENDERER_MARQUEE_MS * 1000ULL);
+}
+
+static void StopMarqueeTimer(void) { esp_timer_stop(marquee_timer); }
+#endif
+
+static void SetScrolling(menu_renderer_t *renderer, bool scrolling) {
+  if (renderer->scrolling == scrolling)
+    return;
+
+  xSemaphoreTake(scrolling_lock, portMAX_DELAY);
+  if (scrolling) {
+    if (!marquee_timer && CreateMarqueeTimer() != ESP_OK) {
+      ESP_LOGE(TAG, "Cannot create marquee timer");
+      xSemaphoreGive(scrolling_lock);
+      return;
+    }
+    if (!scrolling_list)
+      StartMarqueeTimer();
+    renderer->marquee_next = scrolling_list;
+    scrolling_list = renderer;
+  } else {
+    menu_renderer_t **link = &scrolling_list;
+    while (*link != renderer)
+      link = &(*link)->marquee_next;
+    *link = renderer->marquee_next;
+    if (!scrolling_list)
+      StopMarqueeTimer();
+  }
+  renderer->scrolling = scrolling;
+  xSemaphoreGive(scrolling_lock);
+}
+
+// Forget windows not drawn in the frame being flushed and scroll while some
+// text is longer than its window.
+static void UpdateMarquees(menu_renderer_t *renderer) {
+  bool scrolling = false;
+
+  for (uint8_t i = 0; i < MENU_RENDERER_MARQUEES; i++) {
+    menu_renderer_marquee_t *window = &renderer->marquees[i];
+    if (!window->drawn)
+      window->text = NULL;
+    window->drawn = false;
+    scrolling |= window->text != NULL;
+  }
+  SetScrolling(renderer, scrolling && renderer->marquee_redraw);
+}
+
+static esp_err_t WriteRun(menu_renderer_t *renderer, uint8_t row,
+                          uint8_t start, uint8_t end) {
+  esp_err_t err;
+  size_t offset = (size_t)row * renderer->cols + start;
+
+  if (!renderer->cursor_valid || renderer->cursor_col != start ||
+      renderer->cursor_row != row) {
+    err = renderer->backend.set_cursor(renderer->backend.ctx, start, row);
+    if (err != ESP_OK)
+      return err;
+  }
+
+  err = renderer->backend.write(renderer->backend.ctx,
+                                &renderer->frame[offset], end - start);
+  if (err != ESP_OK)
+    return err;
+
+  memcpy(&renderer->shown[offset], &renderer->frame[offset], end - start);
+
+  // Past the last column the display cursor jumps to a device specific
+  // address, so only trust it inside the row.
+  renderer->cursor_col = end;
+  renderer->cursor_row = row;
+  renderer->cursor_valid = end < renderer->cols;
+  return ESP_OK;
+}
+
+// Send the glyphs that took a slot since the last flush.
+static esp_err_t UploadGlyphs(menu_renderer_t *renderer) {
+  for (uint8_t slot = 0; slot < MENU_RENDERER_GLYPH_SLOTS; slot++) {
+    menu_renderer_slot_t *entry = &renderer->slots[slot];
+    if (!entry->glyph || !entry->upload)
+      continue;
+
+    esp_err_t err = renderer->backend.upload_glyph(
+        renderer->backend.ctx, slot, entry->glyph->bitmap);
+    if (err != ESP_OK)
+      return err;
+
+    entry->upload = false;
+    renderer->cursor_valid = false;
+  }
+  return ESP_OK;
+}
+
+static bool ValidArgs(menu_renderer_t *renderer, uint8_t cols, uint8_t rows,
+                      const menu_renderer_backend_t *backend) {
+  return renderer && backend && backend->set_cursor && backend->write &&
+         cols && rows;
+}
+
+// Everything but the framebuffers.
+static void Setup(menu_renderer_t *renderer, uint8_t cols, uint8_t rows,
+                  const menu_renderer_backend_t *backend) {
+  renderer->cols = cols;
+  renderer->rows = rows;
+  renderer->merge_gap = CONFIG_MENU_RENDERER_MERGE_GAP;
+  renderer->backend = *backend;
+  renderer->frame_count = 0;
+  memset(renderer->slots, 0, sizeof(renderer->slots));
+  renderer->glyph_hits = 0;
+  renderer->glyph_misses = 0;
+  renderer->glyph_fallbacks = 0;
+  memset(renderer->marquees, 0, sizeof(renderer->marquees));
+  renderer->marquee_step = 0;
+  renderer->marquee_redraw = NULL;
+  renderer->marquee_arg = NULL;
+  renderer->marquee_next = NULL;
+  if (!scrolling_lock)
+    scrolling_lock = xSemaphoreCreateMutexStatic(&scrolling_lock_buffer);
+  menu_renderer_clear(renderer);
+  menu_renderer_invalidate(renderer);
+}
+
+#if !CONFIG_MENU_NO_HEAP
+esp_err_t menu_renderer_init(menu_renderer_t *renderer, uint8_t cols,
+                             uint8_t rows,
+                             const menu_renderer_backend_t *backend) {
+  if (!ValidArgs(renderer, cols, rows, backend))
+    return ESP_ERR_INVALID_ARG;
+
+  renderer->scrolling = false;
+  renderer->caller_buffer = false;
+  renderer->frame = malloc((size_t)cols * rows);
+  renderer->shown = malloc((size_t)cols * rows);
+  if (!renderer->frame || !renderer->shown) {
+    ESP_LOGE(TAG, "No memory for %ux%u framebuffer", cols, rows);
+    menu_renderer_deinit(renderer);
+    return ESP_ERR_NO_MEM;
+  }
+
+  Setup(renderer, cols, rows, backend);
+  return ESP_OK;
+}
+#endif
+
+esp_err_t menu_renderer_init_static(menu_renderer_t *renderer, uint8_t cols,
+                                    uint8_t rows,
+                                    const menu_renderer_backend_t *backend,
+                                    char *buffer) {
+  if (!ValidArgs(renderer, cols, rows, backend) || !buffer)
+    return ESP_ERR_INVALID_ARG;
+
+  renderer->scrolling = false;
+  renderer->caller_buffer = true;
+  renderer->frame = buffer;
+  renderer->shown = buffer + (size_t)cols * rows;
+  Setup(renderer, cols, rows, backend);
+  return ESP_OK;
+}
+
+void menu_renderer_deinit(menu_renderer_t *renderer) {
+  if (renderer->scrolling)
+    SetScrolling(renderer, false);
+#if !CONFIG_MENU_NO_HEAP
+  if (!renderer->caller_buffer) {
+    free(renderer->frame);
+    free(renderer->shown);
+  }
+#endif
+  renderer->frame = NULL;
+  renderer->shown = NULL;
+}
+
+void menu_renderer_clear(menu_renderer_t *renderer) {
+  memset(renderer->frame, ' ', (size_t)renderer->cols * renderer->rows);
+}
+
+void menu_renderer_putc(menu_renderer_t *renderer, uint8_t col, uint8_t row,
+                        char c) {
+  if (col < renderer->cols && row < renderer->rows)
+    renderer->frame[(size_t)row * renderer->cols + col] = c;
+}
+
+uint8_t menu_renderer_puts(menu_renderer_t *renderer, uint8_t col,
+                           uint8_t row, const char *str) {
+  if (row >= renderer->rows)
+    return col;
+
+  while (*str && col < renderer->cols) {
+    renderer->frame[(size_t)row * renderer->cols + col] = *str++;
+    col++;
+  }
+  return col;
+}
+
+uint8_t menu_renderer_marquee(menu_renderer_t *renderer, uint8_t col,
+                              uint8_t row, uint8_t width, const char *text) {
+  menu_renderer_marquee_t *window = NULL;
+  size_t len = strlen(text);
+  size_t offset = 0;
+
+  if (row >= renderer->rows || col >= renderer->cols)
+    return col;
+  if (width > renderer->cols - col)
+    width = renderer->cols - col;
+  if (!width)
+    return col;
+
+  if (len > width) {
+    menu_renderer_marquee_t *free_window = NULL;
+    for (uint8_t i = 0; i < MENU_RENDERER_MARQUEES; i++) {
+      menu_renderer_marquee_t *entry = &renderer->marquees[i];
+      if (!entry->text) {
+        if (!free_window)
+          free_window = entry;
+      } else if (entry->text == text && entry->len == len &&
+                 entry->row == row && entry->col == col &&
+                 entry->width == width) {
+        window = entry;
+        break;
+      }
+    }
+
+    // Without a free window the text is cut like menu_renderer_puts().
+    if (!window && free_window) {
+      window = free_window;
+      window->text = text;
+      window->len = len;
+      window->row = row;
+      window->col = col;
+      window->width = width;
+      window->start = renderer->marquee_step;
+    }
+  }
+
+  if (window) {
+    uint32_t span = len - width;
+    uint32_t hold = CONFIG_MENU_RENDERER_MARQUEE_HOLD;
+    uint32_t phase =
+        (renderer->marquee_step - window->start) % (span + 2 * hold);
+
+    if (phase < hold)
+      offset = 0;
+    else if (phase < hold + span)
+      offset = phase - hold;
+    else
+      offset = span;
+    window->drawn = true;
+  }
+
+  char *cell = &renderer->frame[(size_t)row * renderer->cols + col];
+  for (uint8_t i = 0; i < width; i++)
+    cell[i] = offset + i < len ? text[offset + i] : ' ';
+  return col + width;
+}
+
+void menu_renderer_set_marquee(menu_renderer_t *renderer,
+                               void (*redraw)(void *arg), void *arg) {
+  SetScrolling(renderer, false);
+  renderer->marquee_redraw = redraw;
+  renderer->marquee_arg = arg;
+}
+
+char menu_renderer_glyph(menu_renderer_t *renderer,
+                         const menu_renderer_glyph_t *glyph) {
+  menu_renderer_slot_t *victim = NULL;
+
+  if (!renderer->backend.upload_glyph) {
+    renderer->glyph_fallbacks++;
+    return glyph->fallback;
+  }
+
+  for (uint8_t slot = 0; slot < MENU_RENDERER_GLYPH_SLOTS; slot++) {
+    menu_renderer_slot_t *entry = &renderer->slots[slot];
+    if (entry->glyph == glyph) {
+      entry->used = renderer->frame_count;
+      renderer->glyph_hits++;
+      return MENU_RENDERER_GLYPH_CODE + slot;
+    }
+
+    // Free slots first, then the least recently used one. A slot drawn in
+    // this frame cannot change its glyph.
+    if (victim && !victim->glyph)
+      continue;
+    if (!entry->glyph ||
+        (entry->used != renderer->frame_count &&
+         (!victim || entry->used < victim->used))) {
+      victim = entry;
+    }
+  }
+
+  if (!victim) {
+    renderer->glyph_fallbacks++;
+    return glyph->fallback;
+  }
+
+  char code = MENU_RENDERER_GLYPH_CODE + (victim - renderer->slots);
+  if (victim->glyph) {
+    // Cells kept from an earlier frame would turn into the new glyph.
+    size_t size = (size_t)renderer->cols * renderer->rows;
+    for (size_t i = 0; i < size; i++) {
+      if (renderer->frame[i] == code)
+        renderer->frame[i] = victim->glyph->fallback;
+    }
+  }
+
+  victim->glyph = glyph;
+  victim->used = renderer->frame_count;
+  victim->upload = true;
+  renderer->glyph_misses++;
+  return code;
+}
+
+void menu_renderer_put_glyph(menu_renderer_t *renderer, uint8_t col,
+                             uint8_t row, const menu_renderer_glyph_t *glyph) {
+  // Off the display it would take a slot for nothing.
+  if (col < renderer->cols && row < renderer->rows) {
+    renderer->frame[(size_t)row * renderer->cols + col] =
+        menu_renderer_glyph(renderer, glyph);
+  }
+}
+
+void menu_renderer_invalidate(menu_renderer_t *renderer) {
+  renderer->invalid = true;
+  renderer->cursor_valid = false;
+  for (uint8_t slot = 0; slot < MENU_RENDERER_GLYPH_SLOTS; slot++)
+    renderer->slots[slot].upload = renderer->slots[slot].glyph != NULL;
+}
+
+esp_err_t menu_renderer_flush(menu_renderer_t *renderer) {
+  bool all = renderer->invalid;
+  esp_err_t err;
+
+  // Glyphs asked for from now on belong to the next frame.
+  renderer->frame_count++;
+  UpdateMarquees(renderer);
+
+  err = UploadGlyphs(renderer);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Backend error %d, full redraw on next flush", err);
+    menu_renderer_invalidate(renderer);
+    return err;
+  }
+
+  for (uint8_t row = 0; row < renderer->rows; row++) {
+    const char *frame = &renderer->frame[(size_t)row * renderer->cols];
+    const char *shown = &renderer->shown[(size_t)row * renderer->cols];
+    uint8_t col = 0;
+
+    while (col < renderer->cols) {
+      if (!all && frame[col] == shown[col]) {
+        col++;
+        continue;
+      }
+
+      // Extend the run while the unchanged gaps are cheaper to rewrite than
+      // a cursor move.
+      uint8_t end = col + 1;
+      uint8_t gap = 0;
+      for (uint8_t next = end; next < renderer->cols; next++) {
+        if (all || frame[next] != shown[next]) {
+          end = next + 1;
+          gap = 0;
+        } else if (++gap > renderer->merge_gap) {
+          break;
+        }
+      }
+
+      err = WriteRun(renderer, row, col, end);
+      if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Backend error %d, full redraw on next flush", err);
+        menu_renderer_invalidate(renderer);
+        return err;
+      }
+      col = end;
+    }
+  }
+
+  if (renderer->backend.flush) {
+    err = renderer->backend.flush(renderer->backend.ctx);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Backend error %d, full redraw on next flush", err);
+      menu_renderer_invalidate(renderer);
+      return err;
+    }
+  }
+
+  renderer->invalid = false;
+  return ESP_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
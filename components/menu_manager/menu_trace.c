@@ -0,0 +1,182 @@
+#include "menu_trace.h"
+#include "esp_timer.h"
+#include "menu_manager.h"
+#include "menu_trace_hooks.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_MENU_TRACE
+
+static uint32_t Duration(int64_t from, int64_t to) {
+  int64_t us = to - from;
+  if (us < 0)
+    return 0;
+  return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static uint8_t Bucket(uint32_t us) {
+  uint8_t bucket = 0;
+
+  for (us >>= 4; us && bucket < MENU_TRACE_BUCKETS - 1; us >>= 1)
+    bucket++;
+  return bucket;
+}
+
+static void Add(menu_trace_stat_t *stat, uint64_t *sum, uint32_t us) {
+  if (!stat->count || us < stat->min)
+    stat->min = us;
+  if (us > stat->max)
+    stat->max = us;
+  stat->count++;
+  stat->histogram[Bucket(us)]++;
+  *sum += us;
+}
+
+// Copy the record at a ring position, false when it was overwritten or is
+// being written.
+static bool ReadSlot(menu_ctx_t *ctx, uint32_t pos,
+                     menu_trace_record_t *record) {
+  menu_trace_slot_t *slot = &ctx->trace[pos % CONFIG_MENU_TRACE_SIZE];
+  uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+  if (seq != (pos << 1) + 2)
+    return false;
+  *record = slot->record;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static uint32_t FirstPosition(menu_ctx_t *ctx, uint32_t head) {
+  uint32_t start = __atomic_load_n(&ctx->trace_start, __ATOMIC_RELAXED);
+
+  if (head - start > CONFIG_MENU_TRACE_SIZE)
+    start = head - CONFIG_MENU_TRACE_SIZE;
+  return start;
+}
+
+void menu_trace_dequeued(menu_ctx_t *ctx, const menu_command_t *item) {
+  int64_t now = esp_timer_get_time();
+
+  ctx->trace_record = (menu_trace_record_t){
+      .command = (Navigate_t)item->command,
+      .enqueued = -1,
+      .dequeued = now,
+      .shown = -1,
+  };
+  // Unsigned difference of the low bits is right across their wrap.
+  if (item->stamp && item->stamp <= MENU_TRACE_STAMPS) {
+    uint32_t queued = (uint32_t)now - ctx->trace_stamps[item->stamp - 1];
+    ctx->trace_record.enqueued = now - queued;
+  }
+}
+
+void menu_trace_changed(menu_ctx_t *ctx) {
+  if (ctx->trace_record.dequeued)
+    ctx->trace_record.changed = esp_timer_get_time();
+}
+
+void menu_trace_done(menu_ctx_t *ctx, menu_trace_record_t *record,
+                     bool shown) {
+  if (!record->dequeued)
+    return;
+  if (shown)
+    record->shown = esp_timer_get_time();
+
+  // Writers claim a position, so the render task and the menu loop can both
+  // write. Readers check seq around their copy instead of locking.
+  uint32_t pos = __atomic_fetch_add(&ctx->trace_head, 1, __ATOMIC_RELAXED);
+  menu_trace_slot_t *slot = &ctx->trace[pos % CONFIG_MENU_TRACE_SIZE];
+
+  __atomic_store_n(&slot->seq, (pos << 1) + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->record = *record;
+  __atomic_store_n(&slot->seq, (pos << 1) + 2, __ATOMIC_RELEASE);
+
+  record->dequeued = 0;
+}
+
+void menu_trace_move(menu_trace_record_t *dst, menu_trace_record_t *src) {
+  *dst = *src;
+  src->dequeued = 0;
+}
+
+void menu_trace_stamp(menu_ctx_t *ctx, menu_command_t *item) {
+  uint32_t slot = __atomic_fetch_add(&ctx->trace_stamp_next, 1,
+                                     __ATOMIC_RELAXED) %
+                  MENU_TRACE_STAMPS;
+
+  // The queue send that follows publishes the time with the item.
+  ctx->trace_stamps[slot] = (uint32_t)esp_timer_get_time();
+  item->stamp = slot + 1;
+}
+
+size_t menu_trace_read(menu_ctx_t *ctx, menu_trace_record_t *records,
+                       size_t max) {
+  uint32_t head = __atomic_load_n(&ctx->trace_head, __ATOMIC_ACQUIRE);
+  uint32_t pos = FirstPosition(ctx, head);
+  size_t count = 0;
+
+  if (head - pos > max)
+    pos = head - max;
+  for (; pos != head; pos++) {
+    if (ReadSlot(ctx, pos, &records[count]))
+      count++;
+  }
+  return count;
+}
+
+void menu_trace_summary(menu_ctx_t *ctx, menu_trace_summary_t *summary) {
+  uint32_t head = __atomic_load_n(&ctx->trace_head, __ATOMIC_ACQUIRE);
+  uint64_t queue = 0, process = 0, show = 0, total = 0;
+  menu_trace_record_t record;
+
+  memset(summary, 0, sizeof(*summary));
+  for (uint32_t pos = FirstPosition(ctx, head); pos != head; pos++) {
+    if (!ReadSlot(ctx, pos, &record))
+      continue;
+
+    summary->records++;
+    int64_t start = record.dequeued;
+    if (record.enqueued >= 0) {
+      Add(&summary->queue, &queue, Duration(record.enqueued, record.dequeued));
+      start = record.enqueued;
+    }
+    Add(&summary->process, &process,
+        Duration(record.dequeued, record.changed));
+    if (record.shown < 0) {
+      summary->unshown++;
+      continue;
+    }
+    Add(&summary->show, &show, Duration(record.changed, record.shown));
+    Add(&summary->total, &total, Duration(start, record.shown));
+  }
+
+  if (summary->queue.count)
+    summary->queue.avg = queue / summary->queue.count;
+  if (summary->process.count)
+    summary->process.avg = process / summary->process.count;
+  if (summary->show.count)
+    summary->show.avg = show / summary->show.count;
+  if (summary->total.count)
+    summary->total.avg = total / summary->total.count;
+}
+
+void menu_trace_reset(menu_ctx_t *ctx) {
+  __atomic_store_n(&ctx->trace_start,
+                   __atomic_load_n(&ctx->trace_head, __ATOMIC_ACQUIRE),
+                   __ATOMIC_RELAXED);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
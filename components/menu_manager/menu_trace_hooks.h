@@ -0,0 +1,45 @@
+// Trace hooks of the menu loop, private to menu_manager. Without
+// CONFIG_MENU_TRACE they expand to nothing.
+#pragma once
+#include "menu_manager.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_MENU_TRACE
+
+/**
+ * @brief Start the record of a received queue item.
+ */
+void menu_trace_dequeued(menu_ctx_t *ctx, const menu_command_t *item);
+
+/**
+ * @brief The state of the traced command has been applied.
+ */
+void menu_trace_changed(menu_ctx_t *ctx);
+
+/**
+ * @brief Write a record in the ring, shown when a frame has just shown its
+ * state. Records without a command are ignored.
+ */
+void menu_trace_done(menu_ctx_t *ctx, menu_trace_record_t *record,
+                     bool shown);
+
+/**
+ * @brief Move a record, src has no command afterwards.
+ */
+void menu_trace_move(menu_trace_record_t *dst, menu_trace_record_t *src);
+
+#else
+#define menu_trace_dequeued(ctx, item)
+#define menu_trace_changed(ctx)
+#define menu_trace_done(ctx, record, shown)
+#define menu_trace_move(dst, src)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,34 @@
+#include "menu_tree.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#include "menu_no_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *menu_tree_label(const menu_tree_t *tree, uint16_t node) {
+  return &tree->strings[tree->nodes[node].label];
+}
+
+uint16_t menu_tree_num_children(const menu_tree_t *tree, uint16_t node) {
+  return tree->nodes[node].num_children;
+}
+
+uint16_t menu_tree_child(const menu_tree_t *tree, uint16_t node,
+                         uint16_t index) {
+  return tree->nodes[node].first_child + index;
+}
+
+void (*menu_tree_function(const menu_tree_t *tree, uint16_t node))(void *) {
+  uint16_t function = tree->nodes[node].function;
+
+  if (function == MENU_TREE_NO_FUNCTION)
+    return NULL;
+  return tree->functions[function];
+}
+
+#ifdef __cplusplus
+}
+#endif
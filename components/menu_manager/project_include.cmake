@@ -0,0 +1,29 @@
+set(MENU_TREE_GEN ${CMAKE_CURRENT_LIST_DIR}/tools/menu_tree_gen.py)
+
+# menu_tree_generate(<description> NAME <name>)
+#
+# Call it in a component CMakeLists.txt after idf_component_register().
+# Generates <name>.c and <name>.h with a const menu_tree_t <name> from the
+# description file and adds them to the component.
+function(menu_tree_generate description)
+    cmake_parse_arguments(arg "" "NAME" "" ${ARGN})
+    if(NOT arg_NAME)
+        message(FATAL_ERROR "menu_tree_generate: NAME is required")
+    endif()
+
+    idf_build_get_property(python PYTHON)
+    get_filename_component(description ${description} ABSOLUTE)
+    set(out_dir ${CMAKE_CURRENT_BINARY_DIR}/menu_tree)
+    set(out_c ${out_dir}/${arg_NAME}.c)
+    set(out_h ${out_dir}/${arg_NAME}.h)
+
+    add_custom_command(OUTPUT ${out_c} ${out_h}
+        COMMAND ${python} ${MENU_TREE_GEN} ${description}
+                --name ${arg_NAME} --out-dir ${out_dir}
+        DEPENDS ${description} ${MENU_TREE_GEN}
+        COMMENT "Generating menu tree ${arg_NAME}"
+        VERBATIM)
+
+    target_sources(${COMPONENT_LIB} PRIVATE ${out_c})
+    target_include_directories(${COMPONENT_LIB} PRIVATE ${out_dir})
+endfunction()
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Decode the menu_mirror stream of a menu and show its display on the host.
+
+Reads a capture file, or a serial port with pyserial, and prints every
+frame as rows between '|' like the headless harness scripts:
+
+    menu_mirror.py capture.bin
+    menu_mirror.py --port /dev/ttyUSB0 --baud 115200
+
+On a serial port the decoder asks for a full frame when it starts and when
+a sequence number is skipped. Lines typed on stdin send commands: u (UP),
+d (DOWN), s (SELECT), b (BACK), r (full frame).
+
+Decoder can be imported by tests: iterate feed(bytes) and read screen after
+each packet.
+"""
+
+import argparse
+import sys
+import threading
+
+SYNC = b'\xa5\x5a'
+COMMAND = 0x5A
+RESYNC = 0x80
+
+DELTA = 1
+FULL = 2
+GLYPH = 3
+
+# Navigate_t values.
+COMMANDS = {'u': 0, 'd': 1, 's': 2, 'b': 3, 'r': RESYNC}
+
+# Shown for custom characters, their bitmaps are in Decoder.glyphs.
+GLYPH_CODE = 0x08
+GLYPH_SLOTS = 8
+GLYPH_CHAR = '#'
+
+
+def command(value):
+    """Bytes of one host command."""
+    return bytes([COMMAND, value, value ^ 0xFF])
+
+
+class Decoder:
+    def __init__(self):
+        self.buffer = b''
+        self.screen = None  # list of bytearray rows, None before a FULL
+        self.glyphs = {}
+        self.seq = None
+        self.packets = 0
+        self.lost = 0
+        self.bad = 0
+        self.need_resync = True
+
+    def feed(self, data):
+        """Parse bytes, yield the type of each packet once it is applied."""
+        self.buffer += data
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                self.buffer = self.buffer[-1:]
+                return
+            self.buffer = self.buffer[start:]
+            if len(self.buffer) < 7:
+                return
+            length = self.buffer[5] | self.buffer[6] << 8
+            if len(self.buffer) < 8 + length:
+                return
+
+            packet = self.buffer[2:7 + length]
+            check = self.buffer[7 + length]
+            if sum(packet) & 0xFF != check:
+                # Skip the sync bytes and look for the next packet.
+                self.bad += 1
+                self.buffer = self.buffer[2:]
+                continue
+            self.buffer = self.buffer[8 + length:]
+            self.apply(packet[0], packet[1] | packet[2] << 8, packet[5:])
+            yield packet[0]
+
+    def apply(self, kind, seq, payload):
+        self.packets += 1
+        if self.seq is not None and seq != (self.seq + 1) & 0xFFFF:
+            self.lost += (seq - self.seq - 1) & 0xFFFF
+            self.need_resync = True
+        self.seq = seq
+
+        if kind == FULL:
+            cols, rows = payload[0], payload[1]
+            cells = payload[2:]
+            self.screen = [bytearray(cells[row * cols:(row + 1) * cols])
+                           for row in range(rows)]
+            self.need_resync = False
+        elif kind == DELTA and self.screen is not None:
+            at = 0
+            while at + 3 <= len(payload):
+                row, col, count = payload[at], payload[at + 1], payload[at + 2]
+                self.screen[row][col:col + count] = payload[at + 3:
+                                                            at + 3 + count]
+                at += 3 + count
+        elif kind == GLYPH:
+            self.glyphs[payload[0]] = bytes(payload[1:9])
+
+    def rows(self):
+        """Rows as text, custom characters as GLYPH_CHAR."""
+        if self.screen is None:
+            return []
+        out = []
+        for row in self.screen:
+            text = ''
+            for byte in row:
+                if GLYPH_CODE <= byte < GLYPH_CODE + GLYPH_SLOTS:
+                    text += GLYPH_CHAR
+                elif 32 <= byte < 127:
+                    text += chr(byte)
+                else:
+                    text += '?'
+            out.append(text)
+        return out
+
+
+def print_frame(decoder):
+    for row in decoder.rows():
+        print(f'|{row}|')
+    print(flush=True)
+
+
+def decode_file(path):
+    decoder = Decoder()
+    with open(path, 'rb') as f:
+        for kind in decoder.feed(f.read()):
+            if kind != GLYPH:
+                print_frame(decoder)
+    print(f'packets {decoder.packets}, lost {decoder.lost}, '
+          f'bad {decoder.bad}', file=sys.stderr)
+    return 1 if decoder.lost or decoder.bad else 0
+
+
+def mirror_port(port, baud):
+    import serial
+
+    link = serial.Serial(port, baud, timeout=0.1)
+    decoder = Decoder()
+
+    def keys():
+        for line in sys.stdin:
+            for key in line.strip():
+                if key in COMMANDS:
+                    link.write(command(COMMANDS[key]))
+
+    threading.Thread(target=keys, daemon=True).start()
+    link.write(command(RESYNC))
+    while True:
+        for kind in decoder.feed(link.read(256)):
+            if kind != GLYPH:
+                print_frame(decoder)
+        if decoder.need_resync and decoder.screen is not None:
+            decoder.need_resync = False
+            link.write(command(RESYNC))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('capture', nargs='?', help='file with a capture')
+    parser.add_argument('--port', help='serial port of the device')
+    parser.add_argument('--baud', type=int, default=115200)
+    args = parser.parse_args()
+    if args.port:
+        mirror_port(args.port, args.baud)
+    elif args.capture:
+        sys.exit(decode_file(args.capture))
+    else:
+        parser.error('a capture file or --port is required')
+
+
+if __name__ == '__main__':
+    main()
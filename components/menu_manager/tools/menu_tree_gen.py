@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Generate a packed flash menu tree (menu_tree_t) from a text description.
+
+Each line is one node, children are indented deeper than their parent and
+leaves name their function after '=':
+
+    root
+      Settings
+        Backlight = switch_blacklight
+      About = show_about
+
+Lines starting with '#' are comments. Node 0 is the first line.
+"""
+
+import argparse
+import os
+import sys
+
+# sizeof(menu_node_t) on the 32 bit targets: label, submenus, num_options,
+# function, virtual_menu and value, 4 bytes each. Keep it in step with the
+# struct in menu_manager.h.
+MENU_NODE_T_SIZE = 24
+MENU_TREE_NODE_T_SIZE = 8
+# menu_path_t.current_index selects a child with 16 bits.
+MAX_CHILDREN = 0xFFFF
+
+
+class Node:
+    def __init__(self, label, function, line):
+        self.label = label
+        self.function = function
+        self.line = line
+        self.children = []
+        self.index = None
+
+
+def parse(path):
+    root = None
+    stack = []  # (indent, node)
+    with open(path, encoding='utf-8') as f:
+        for number, raw in enumerate(f, 1):
+            text = raw.rstrip('\n')
+            if not text.strip() or text.lstrip().startswith('#'):
+                continue
+            indent = len(text) - len(text.lstrip(' '))
+            label, _, function = text.strip().partition('=')
+            node = Node(label.strip(), function.strip() or None, number)
+            if not node.label:
+                sys.exit(f'{path}:{number}: empty label')
+
+            while stack and stack[-1][0] >= indent:
+                stack.pop()
+            if not stack:
+                if root is not None:
+                    sys.exit(f'{path}:{number}: second root "{node.label}"')
+                root = node
+            else:
+                parent = stack[-1][1]
+                if parent.function:
+                    sys.exit(f'{path}:{number}: "{parent.label}" has a '
+                             'function and cannot have children')
+                parent.children.append(node)
+            stack.append((indent, node))
+
+    if root is None:
+        sys.exit(f'{path}: no nodes')
+    return root
+
+
+def layout(root, path):
+    """Breadth first order, so children of a node are consecutive."""
+    order = [root]
+    for node in order:
+        if len(node.children) > MAX_CHILDREN:
+            sys.exit(f'{path}:{node.line}: "{node.label}" has '
+                     f'{len(node.children)} children, more than 16 bit '
+                     'indices allow')
+        order.extend(node.children)
+    for index, node in enumerate(order):
+        node.index = index
+    if len(order) > 0xFFFF:
+        sys.exit(f'{len(order)} nodes, more than 16 bit indices allow')
+    return order
+
+
+def string_pool(labels):
+    """Deduplicated pool, a label that ends another one shares its bytes."""
+    offsets = {}
+    pool = b''
+    # Ties sorted by text, the pool must not depend on PYTHONHASHSEED.
+    for label in sorted(set(labels), key=lambda l: (-len(l.encode()), l)):
+        data = label.encode() + b'\0'
+        at = pool.find(data)
+        if at < 0:
+            at = len(pool)
+            pool += data
+        offsets[label] = at
+    if len(pool) > 0xFFFF:
+        sys.exit(f'string pool of {len(pool)} bytes, more than 16 bit '
+                 'offsets allow')
+    return pool, offsets
+
+
+def c_string(data):
+    out = ''
+    for byte in data:
+        char = chr(byte)
+        if char in '"\\':
+            out += '\\' + char
+        elif 32 <= byte < 127:
+            out += char
+        else:
+            out += '\\%03o' % byte
+    return '"' + out + '"'
+
+
+def generate(description, name, out_dir):
+    root = parse(description)
+    order = layout(root, description)
+    pool, offsets = string_pool(node.label for node in order)
+
+    functions = []
+    for node in order:
+        if node.function and node.function not in functions:
+            functions.append(node.function)
+
+    source = os.path.basename(description)
+    header = [
+        f'/* Generated by menu_tree_gen.py from {source}, do not edit. */',
+        '#pragma once',
+        '#include <menu_tree.h>',
+        '',
+        f'extern const menu_tree_t {name};',
+        '',
+    ]
+
+    body = [
+        f'/* Generated by menu_tree_gen.py from {source}, do not edit. */',
+        f'#include "{name}.h"',
+        '',
+    ]
+    body += [f'void {function}(void *args);' for function in functions]
+    body += ['', f'static const char {name}_strings[] =']
+    for chunk in pool.split(b'\0')[:-1]:
+        body.append('    ' + c_string(chunk + b'\0'))
+    body[-1] += ';'
+
+    body += ['', f'static const menu_tree_node_t {name}_nodes[] = {{']
+    for node in order:
+        first = node.children[0].index if node.children else 0
+        function = (functions.index(node.function) if node.function
+                    else 'MENU_TREE_NO_FUNCTION')
+        body.append(f'    {{{offsets[node.label]}, {first}, '
+                    f'{len(node.children)}, {function}}}, /* {node.label} */')
+    body.append('};')
+
+    body.append('')
+    if functions:
+        body.append(f'static void (*const {name}_functions[])(void *args) = {{')
+        body += [f'    &{function},' for function in functions]
+        body.append('};')
+        table = f'{name}_functions'
+    else:
+        table = 'NULL'
+
+    body += [
+        '',
+        f'const menu_tree_t {name} = {{',
+        f'    .nodes = {name}_nodes,',
+        f'    .num_nodes = {len(order)},',
+        f'    .strings = {name}_strings,',
+        f'    .functions = {table},',
+        '};',
+        '',
+    ]
+
+    os.makedirs(out_dir, exist_ok=True)
+    with open(os.path.join(out_dir, f'{name}.h'), 'w') as f:
+        f.write('\n'.join(header))
+    with open(os.path.join(out_dir, f'{name}.c'), 'w') as f:
+        f.write('\n'.join(body))
+
+    nodes_size = len(order) * MENU_TREE_NODE_T_SIZE
+    print(f'menu_tree {name}: {len(order)} nodes, {nodes_size} B nodes + '
+          f'{len(pool)} B strings in flash, saves {MENU_NODE_T_SIZE} B RAM '
+          f'per node ({len(order) * MENU_NODE_T_SIZE} B total)')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('description', help='menu description file')
+    parser.add_argument('--name', required=True,
+                        help='name of the menu_tree_t variable and files')
+    parser.add_argument('--out-dir', required=True,
+                        help='directory for <name>.c and <name>.h')
+    args = parser.parse_args()
+    generate(args.description, args.name, args.out_dir)
+
+
+if __name__ == '__main__':
+    main()
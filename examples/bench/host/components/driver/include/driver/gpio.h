@@ -0,0 +1,9 @@
+/**
+ * @file gpio.h
+ * @brief GPIO types included by dimmer.h, nothing is driven on the host.
+ */
+
+#pragma once
+#include <stdint.h>
+
+typedef int gpio_num_t;
@@ -0,0 +1,142 @@
+/**
+ * @file mcpwm_prelude.h
+ * @brief Host stub of the MCPWM driver API used by dimmer.c. Handles are
+ * plain allocations, comparators keep the last compare value and call the
+ * hook of mcpwm_stub.h.
+ */
+
+#pragma once
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SOC_MCPWM_GROUPS 2
+
+typedef struct mcpwm_timer_t *mcpwm_timer_handle_t;
+typedef struct mcpwm_oper_t *mcpwm_oper_handle_t;
+typedef struct mcpwm_cmpr_t *mcpwm_cmpr_handle_t;
+typedef struct mcpwm_gen_t *mcpwm_gen_handle_t;
+typedef struct mcpwm_sync_t *mcpwm_sync_handle_t;
+
+typedef enum {
+  MCPWM_TIMER_CLK_SRC_DEFAULT,
+} mcpwm_timer_clock_source_t;
+
+typedef enum {
+  MCPWM_TIMER_COUNT_MODE_UP,
+} mcpwm_timer_count_mode_t;
+
+typedef enum {
+  MCPWM_TIMER_DIRECTION_UP,
+} mcpwm_timer_direction_t;
+
+typedef enum {
+  MCPWM_TIMER_EVENT_EMPTY,
+} mcpwm_timer_event_t;
+
+typedef enum {
+  MCPWM_TIMER_START_NO_STOP,
+} mcpwm_timer_start_stop_cmd_t;
+
+typedef enum {
+  MCPWM_GEN_ACTION_LOW,
+  MCPWM_GEN_ACTION_HIGH,
+} mcpwm_generator_action_t;
+
+typedef struct {
+  mcpwm_timer_clock_source_t clk_src;
+  int group_id;
+  uint32_t resolution_hz;
+  uint32_t period_ticks;
+  mcpwm_timer_count_mode_t count_mode;
+} mcpwm_timer_config_t;
+
+typedef struct {
+  int group_id;
+} mcpwm_operator_config_t;
+
+typedef struct {
+  struct {
+    uint32_t update_cmp_on_tez : 1;
+  } flags;
+} mcpwm_comparator_config_t;
+
+typedef struct {
+  int gen_gpio_num;
+} mcpwm_generator_config_t;
+
+typedef struct {
+  int group_id;
+  int gpio_num;
+  struct {
+    uint32_t pull_down : 1;
+    uint32_t pull_up : 1;
+    uint32_t active_neg : 1;
+    uint32_t io_loop_back : 1;
+  } flags;
+} mcpwm_gpio_sync_src_config_t;
+
+typedef struct {
+  uint32_t count_value;
+  mcpwm_timer_direction_t direction;
+  mcpwm_sync_handle_t sync_src;
+} mcpwm_timer_sync_phase_config_t;
+
+typedef struct {
+  mcpwm_timer_direction_t direction;
+  mcpwm_timer_event_t event;
+  mcpwm_generator_action_t action;
+} mcpwm_gen_timer_event_action_t;
+
+typedef struct {
+  mcpwm_timer_direction_t direction;
+  mcpwm_cmpr_handle_t comparator;
+  mcpwm_generator_action_t action;
+} mcpwm_gen_compare_event_action_t;
+
+#define MCPWM_GEN_TIMER_EVENT_ACTION(dir, ev, act)                             \
+  (mcpwm_gen_timer_event_action_t) {                                           \
+    .direction = dir, .event = ev, .action = act                               \
+  }
+#define MCPWM_GEN_COMPARE_EVENT_ACTION(dir, cmp, act)                          \
+  (mcpwm_gen_compare_event_action_t) {                                         \
+    .direction = dir, .comparator = cmp, .action = act                         \
+  }
+
+esp_err_t mcpwm_new_timer(const mcpwm_timer_config_t *config,
+                          mcpwm_timer_handle_t *ret_timer);
+esp_err_t mcpwm_timer_enable(mcpwm_timer_handle_t timer);
+esp_err_t mcpwm_timer_disable(mcpwm_timer_handle_t timer);
+esp_err_t mcpwm_timer_start_stop(mcpwm_timer_handle_t timer,
+                                 mcpwm_timer_start_stop_cmd_t command);
+esp_err_t
+mcpwm_timer_set_phase_on_sync(mcpwm_timer_handle_t timer,
+                              const mcpwm_timer_sync_phase_config_t *config);
+esp_err_t mcpwm_new_operator(const mcpwm_operator_config_t *config,
+                             mcpwm_oper_handle_t *ret_oper);
+esp_err_t mcpwm_operator_connect_timer(mcpwm_oper_handle_t oper,
+                                       mcpwm_timer_handle_t timer);
+esp_err_t mcpwm_new_comparator(mcpwm_oper_handle_t oper,
+                               const mcpwm_comparator_config_t *config,
+                               mcpwm_cmpr_handle_t *ret_cmpr);
+esp_err_t mcpwm_comparator_set_compare_value(mcpwm_cmpr_handle_t cmpr,
+                                             uint32_t cmp_ticks);
+esp_err_t mcpwm_new_generator(mcpwm_oper_handle_t oper,
+                              const mcpwm_generator_config_t *config,
+                              mcpwm_gen_handle_t *ret_gen);
+esp_err_t mcpwm_generator_set_action_on_timer_event(
+    mcpwm_gen_handle_t gen, mcpwm_gen_timer_event_action_t ev_act);
+esp_err_t mcpwm_generator_set_action_on_compare_event(
+    mcpwm_gen_handle_t gen, mcpwm_gen_compare_event_action_t ev_act);
+esp_err_t mcpwm_generator_set_force_level(mcpwm_gen_handle_t gen, int level,
+                                          bool hold_on);
+esp_err_t mcpwm_new_gpio_sync_src(const mcpwm_gpio_sync_src_config_t *config,
+                                  mcpwm_sync_handle_t *ret_sync);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,32 @@
+/**
+ * @file mcpwm_stub.h
+ * @brief What the benchmark reads from the MCPWM stub.
+ */
+
+#pragma once
+#include "driver/mcpwm_prelude.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Called by every mcpwm_comparator_set_compare_value(), from the task
+ * that wrote the value.
+ *
+ * @param hook Function receiving the comparator index, in creation order,
+ * and the compare value, NULL for none.
+ */
+void mcpwm_stub_set_hook(void (*hook)(uint32_t comparator, uint32_t value));
+
+/**
+ * @brief Compare values written since start.
+ *
+ * @return Number of writes.
+ */
+uint32_t mcpwm_stub_writes(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,129 @@
+#include "driver/mcpwm_prelude.h"
+#include "mcpwm_stub.h"
+#include <esp_err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct mcpwm_timer_t {
+  uint32_t period_ticks;
+};
+
+struct mcpwm_oper_t {
+  int group_id;
+};
+
+struct mcpwm_cmpr_t {
+  uint32_t index;
+  uint32_t value;
+};
+
+struct mcpwm_gen_t {
+  int gpio;
+};
+
+struct mcpwm_sync_t {
+  int gpio;
+};
+
+static void (*compare_hook)(uint32_t comparator, uint32_t value) = NULL;
+static volatile uint32_t compare_writes = 0;
+static uint32_t comparators = 0;
+
+void mcpwm_stub_set_hook(void (*hook)(uint32_t comparator, uint32_t value)) {
+  compare_hook = hook;
+}
+
+uint32_t mcpwm_stub_writes(void) { return compare_writes; }
+
+esp_err_t mcpwm_new_timer(const mcpwm_timer_config_t *config,
+                          mcpwm_timer_handle_t *ret_timer) {
+  *ret_timer = calloc(1, sizeof(struct mcpwm_timer_t));
+  if (!*ret_timer)
+    return ESP_ERR_NO_MEM;
+  (*ret_timer)->period_ticks = config->period_ticks;
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_timer_enable(mcpwm_timer_handle_t timer) { return ESP_OK; }
+
+esp_err_t mcpwm_timer_disable(mcpwm_timer_handle_t timer) { return ESP_OK; }
+
+esp_err_t mcpwm_timer_start_stop(mcpwm_timer_handle_t timer,
+                                 mcpwm_timer_start_stop_cmd_t command) {
+  return ESP_OK;
+}
+
+esp_err_t
+mcpwm_timer_set_phase_on_sync(mcpwm_timer_handle_t timer,
+                              const mcpwm_timer_sync_phase_config_t *config) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_new_operator(const mcpwm_operator_config_t *config,
+                             mcpwm_oper_handle_t *ret_oper) {
+  *ret_oper = calloc(1, sizeof(struct mcpwm_oper_t));
+  if (!*ret_oper)
+    return ESP_ERR_NO_MEM;
+  (*ret_oper)->group_id = config->group_id;
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_operator_connect_timer(mcpwm_oper_handle_t oper,
+                                       mcpwm_timer_handle_t timer) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_new_comparator(mcpwm_oper_handle_t oper,
+                               const mcpwm_comparator_config_t *config,
+                               mcpwm_cmpr_handle_t *ret_cmpr) {
+  *ret_cmpr = calloc(1, sizeof(struct mcpwm_cmpr_t));
+  if (!*ret_cmpr)
+    return ESP_ERR_NO_MEM;
+  (*ret_cmpr)->index = comparators++;
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_comparator_set_compare_value(mcpwm_cmpr_handle_t cmpr,
+                                             uint32_t cmp_ticks) {
+  void (*hook)(uint32_t comparator, uint32_t value) = compare_hook;
+
+  cmpr->value = cmp_ticks;
+  compare_writes++;
+  if (hook)
+    hook(cmpr->index, cmp_ticks);
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_new_generator(mcpwm_oper_handle_t oper,
+                              const mcpwm_generator_config_t *config,
+                              mcpwm_gen_handle_t *ret_gen) {
+  *ret_gen = calloc(1, sizeof(struct mcpwm_gen_t));
+  if (!*ret_gen)
+    return ESP_ERR_NO_MEM;
+  (*ret_gen)->gpio = config->gen_gpio_num;
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_generator_set_action_on_timer_event(
+    mcpwm_gen_handle_t gen, mcpwm_gen_timer_event_action_t ev_act) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_generator_set_action_on_compare_event(
+    mcpwm_gen_handle_t gen, mcpwm_gen_compare_event_action_t ev_act) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_generator_set_force_level(mcpwm_gen_handle_t gen, int level,
+                                          bool hold_on) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_new_gpio_sync_src(const mcpwm_gpio_sync_src_config_t *config,
+                                  mcpwm_sync_handle_t *ret_sync) {
+  *ret_sync = calloc(1, sizeof(struct mcpwm_sync_t));
+  if (!*ret_sync)
+    return ESP_ERR_NO_MEM;
+  (*ret_sync)->gpio = config->gpio_num;
+  return ESP_OK;
+}
@@ -0,0 +1,502 @@
+/*
+ * Host microbenchmarks of the dimmer and menu_manager components.
+ *
+ * Builds for the linux target: the project driver component replaces MCPWM
+ * with a stub that records compare values, and the menu draws through
+ * menu_renderer into a virtual 20x4 display. Every result is one JSON object
+ * per line, so two runs can be diffed with scripts/compare.py:
+ *
+ *   conversion         set_power(), set_dutty() and get_power() per second
+ *   channel_latency    set_task_dimmer_power() to compare value written, per
+ *                      channel
+ *   group_latency      set_dimmer_group_power() to the last member written,
+ *                      and the same channels set one by one
+ *   budget_latency     set_task_dimmer_dutty() on a power budget to the last
+ *                      channel written, under the cap and with the other
+ *                      channels rescaled on every change
+ *   renderer_flush     menu_renderer_flush() of alternating frames
+ *   navigation         menu commands per second, each waiting for its frame
+ *
+ * Environment:
+ *   BENCH_OUT     file the results are written to, default stdout
+ *   BENCH_SCALE   multiplies every iteration count, default 1
+ */
+#include <dimmer.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mcpwm_stub.h>
+#include <menu_manager.h>
+#include <menu_renderer.h>
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "bench";
+
+#define CHANNELS 4
+#define SYNC_GPIO 5
+#define FIRST_GEN_GPIO 16
+#define COLS 20
+#define ROWS 4
+#define CONVERSIONS 1000000
+#define CHANNEL_UPDATES 2000
+#define FLUSHES 20000
+#define NAVIGATION_PASSES 200
+#define TIMEOUT_MS 1000
+
+static FILE *out;
+static unsigned scale = 1;
+static TaskHandle_t bench;
+
+// Written by the MCPWM stub hook, from the dimmer tasks.
+static volatile uint32_t pending;
+static volatile uint32_t expected;
+static volatile uint32_t mismatches;
+
+static task_dimmer_t channels[CHANNELS];
+static dimmer_group_t group;
+static dimmer_budget_t budget;
+static dimmer_budget_channel_t budget_channels[CHANNELS];
+
+static menu_renderer_t renderer;
+static menu_ctx_t ctx;
+static menu_config_t config;
+static uint32_t written_bytes;
+
+// ------------------------------------------------------------------- output
+
+static int compare_latency(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int64_t percentile(const int64_t *sorted, size_t count,
+                          unsigned percent) {
+  size_t rank = (count * percent + 99) / 100;
+  return sorted[rank ? rank - 1 : 0];
+}
+
+// Sort samples and print their fields, inside a record.
+static void put_latency(int64_t *samples, size_t count) {
+  qsort(samples, count, sizeof(int64_t), compare_latency);
+  fprintf(out,
+          ",\"samples\":%zu,\"p50_us\":%lld,\"p90_us\":%lld,\"p99_us\":%lld,"
+          "\"max_us\":%lld",
+          count, (long long)percentile(samples, count, 50),
+          (long long)percentile(samples, count, 90),
+          (long long)percentile(samples, count, 99),
+          (long long)samples[count - 1]);
+}
+
+static void put_rate(const char *bench_name, const char *name, uint32_t ops,
+                     int64_t elapsed) {
+  fprintf(out,
+          "{\"bench\":\"%s\",\"name\":\"%s\",\"ops\":%lu,\"us\":%lld,"
+          "\"ops_per_s\":%.0f}\n",
+          bench_name, name, (unsigned long)ops, (long long)elapsed,
+          ops * 1e6 / (elapsed ? elapsed : 1));
+}
+
+// ------------------------------------------------------------------- dimmer
+
+static void compare_written(uint32_t comparator, uint32_t value) {
+  if (!pending)
+    return;
+  if (expected != UINT32_MAX && value != expected)
+    mismatches++;
+  if (__atomic_sub_fetch(&pending, 1, __ATOMIC_SEQ_CST) == 0)
+    xTaskNotifyGive(bench);
+}
+
+// Count the next writes compare values, value UINT32_MAX accepts any.
+static void expect_writes(uint32_t writes, uint32_t value) {
+  expected = value;
+  pending = writes;
+}
+
+static bool wait_writes(void) {
+  if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TIMEOUT_MS))) {
+    ESP_LOGE(TAG, "%lu compare writes missing", (unsigned long)pending);
+    pending = 0;
+    return false;
+  }
+  return true;
+}
+
+static void bench_conversion(void) {
+  static dimmer_t dimmer;
+  uint32_t count = CONVERSIONS * scale;
+  volatile float sink = 0;
+  int64_t start;
+
+  mcpwm_stub_set_hook(NULL);
+  ESP_ERROR_CHECK(
+      create_dimmer(&dimmer, FIRST_GEN_GPIO + CHANNELS, SYNC_GPIO));
+
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < count; i++)
+    set_power(&dimmer, (i % 1001) / 1000.0);
+  put_rate("conversion", "set_power", count, esp_timer_get_time() - start);
+
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < count; i++)
+    set_dutty(&dimmer, i % 1001);
+  put_rate("conversion", "set_dutty", count, esp_timer_get_time() - start);
+
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < count; i++) {
+    dimmer.dutty = i % 1001;
+    sink += get_power(&dimmer);
+  }
+  put_rate("conversion", "get_power", count, esp_timer_get_time() - start);
+}
+
+static bool create_channels(void) {
+  mcpwm_stub_set_hook(compare_written);
+
+  // Every task writes compare value 0 when it has set up its channel.
+  expect_writes(CHANNELS, 0);
+  for (uint8_t i = 0; i < CHANNELS; i++)
+    channels[i] = create_task_dimmer(FIRST_GEN_GPIO + i, SYNC_GPIO);
+  if (!wait_writes())
+    return false;
+
+  ESP_ERROR_CHECK(create_dimmer_group(&group, "bench"));
+  for (uint8_t i = 0; i < CHANNELS; i++)
+    ESP_ERROR_CHECK(add_dimmer_group_member(&group, &channels[i], 1.0f, 0));
+  return true;
+}
+
+static bool bench_channel_latency(int64_t *samples) {
+  uint32_t count = CHANNEL_UPDATES * scale;
+
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    for (uint32_t i = 0; i < count; i++) {
+      double power = (i % 101) / 100.0;
+      int64_t start;
+
+      expect_writes(1, UINT32_MAX);
+      start = esp_timer_get_time();
+      set_task_dimmer_power(&channels[channel], power);
+      if (!wait_writes())
+        return false;
+      samples[i] = esp_timer_get_time() - start;
+    }
+    fprintf(out, "{\"bench\":\"channel_latency\",\"name\":\"channel\","
+                 "\"channel\":%u",
+            channel);
+    put_latency(samples, count);
+    fprintf(out, "}\n");
+  }
+  return true;
+}
+
+static bool bench_group_latency(int64_t *samples) {
+  uint32_t count = CHANNEL_UPDATES * scale;
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t dutty = i % 1001;
+    int64_t start;
+
+    expect_writes(CHANNELS, 1000 - dutty);
+    start = esp_timer_get_time();
+    set_dimmer_group_dutty(&group, dutty);
+    if (!wait_writes())
+      return false;
+    samples[i] = esp_timer_get_time() - start;
+  }
+  fprintf(out, "{\"bench\":\"group_latency\",\"name\":\"group\","
+               "\"channels\":%u",
+          CHANNELS);
+  put_latency(samples, count);
+  fprintf(out, "}\n");
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t dutty = i % 1001;
+    int64_t start;
+
+    expect_writes(CHANNELS, 1000 - dutty);
+    start = esp_timer_get_time();
+    for (uint8_t channel = 0; channel < CHANNELS; channel++)
+      set_task_dimmer_dutty(&channels[channel], dutty);
+    if (!wait_writes())
+      return false;
+    samples[i] = esp_timer_get_time() - start;
+  }
+  fprintf(out, "{\"bench\":\"group_latency\",\"name\":\"one_by_one\","
+               "\"channels\":%u",
+          CHANNELS);
+  put_latency(samples, count);
+  fprintf(out, "}\n");
+  return true;
+}
+
+// Channel 0 goes from off to full, the others ask for full power at a lower
+// priority. Under the cap only channel 0 is written, over it the other
+// channels are rescaled on every change.
+static bool bench_budget_latency(int64_t *samples) {
+  static const struct {
+    const char *name;
+    uint32_t cap;
+    uint32_t writes;
+  } cases[] = {
+      {"under_cap", 100 * CHANNELS, 1},
+      {"over_cap", 100 * CHANNELS / 2, CHANNELS},
+  };
+  uint32_t count = CHANNEL_UPDATES * scale;
+
+  ESP_ERROR_CHECK(create_dimmer_budget(&budget, cases[0].cap));
+  for (uint8_t i = 0; i < CHANNELS; i++) {
+    ESP_ERROR_CHECK(add_dimmer_budget_channel(&budget, &budget_channels[i],
+                                              &channels[i], 100, i > 0));
+    if (i > 0)
+      set_task_dimmer_dutty(&channels[i], 1000);
+  }
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    ESP_ERROR_CHECK(set_dimmer_budget_cap(&budget, cases[c].cap));
+    for (uint32_t i = 0; i < count; i++) {
+      int64_t start;
+
+      expect_writes(cases[c].writes, UINT32_MAX);
+      start = esp_timer_get_time();
+      set_task_dimmer_dutty(&channels[0], i % 2 ? 1000 : 0);
+      if (!wait_writes())
+        return false;
+      samples[i] = esp_timer_get_time() - start;
+    }
+    fprintf(out,
+            "{\"bench\":\"budget_latency\",\"name\":\"%s\","
+            "\"channels\":%u",
+            cases[c].name, CHANNELS);
+    put_latency(samples, count);
+    fprintf(out, "}\n");
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------- menu
+
+static esp_err_t screen_set_cursor(void *arg, uint8_t col, uint8_t row) {
+  return ESP_OK;
+}
+
+static esp_err_t screen_write(void *arg, const char *data, size_t len) {
+  written_bytes += len;
+  return ESP_OK;
+}
+
+static int32_t levels[8] = {10, 20, 30, 40, 50, 60, 70, 80};
+
+static menu_value_t level_values[8];
+
+static menu_node_t lights[8] = {
+    {.label = "Kitchen", .value = &level_values[0]},
+    {.label = "Living room", .value = &level_values[1]},
+    {.label = "Bedroom", .value = &level_values[2]},
+    {.label = "Bathroom", .value = &level_values[3]},
+    {.label = "Hall", .value = &level_values[4]},
+    {.label = "Garage", .value = &level_values[5]},
+    {.label = "Garden", .value = &level_values[6]},
+    {.label = "Porch", .value = &level_values[7]},
+};
+
+static size_t list_count(void *arg) { return 64; }
+
+static void list_get(void *arg, size_t index, menu_node_t *child, char *label,
+                     size_t label_size) {
+  snprintf(label, label_size, "Channel %u", (unsigned)index + 1);
+}
+
+static menu_virtual_t list = {
+    .count = &list_count,
+    .get_child = &list_get,
+};
+
+static menu_node_t root_options[3] = {
+    {.label = "Lights", .submenus = lights, .num_options = 8},
+    {.label = "Channels", .virtual_menu = &list},
+    {.label = "About"},
+};
+
+// Ends where it starts, on the first option of the root menu.
+static const Navigate_t pass[] = {
+    NAVIGATE_SELECT, NAVIGATE_UP,     NAVIGATE_UP,     NAVIGATE_SELECT,
+    NAVIGATE_UP,     NAVIGATE_DOWN,   NAVIGATE_SELECT, NAVIGATE_UP,
+    NAVIGATE_UP,     NAVIGATE_UP,     NAVIGATE_BACK,   NAVIGATE_UP,
+    NAVIGATE_SELECT, NAVIGATE_UP,     NAVIGATE_UP,     NAVIGATE_UP,
+    NAVIGATE_UP,     NAVIGATE_DOWN,   NAVIGATE_DOWN,   NAVIGATE_DOWN,
+    NAVIGATE_DOWN,   NAVIGATE_BACK,   NAVIGATE_DOWN,
+};
+
+#define PASS_COMMANDS (sizeof(pass) / sizeof(pass[0]))
+
+static void display(menu_path_t *current_path) {
+  uint16_t select = current_path->current_index;
+  uint16_t options = menu_path_num_options(current_path);
+  uint16_t first = select < ROWS - 1 ? 0 : select - (ROWS - 2);
+
+  menu_renderer_clear(&renderer);
+  menu_renderer_puts(&renderer, 0, 0, menu_path_title(current_path));
+  for (uint8_t row = 1; row < ROWS && first + row - 1 < options; row++) {
+    uint16_t option = first + row - 1;
+    menu_value_t *value = menu_path_option_value(current_path, option);
+
+    if (option == select)
+      menu_renderer_putc(&renderer, 0, row, '>');
+    menu_renderer_puts(&renderer, 2, row,
+                       menu_path_option_label(current_path, option));
+    if (value) {
+      char text[8];
+      menu_value_format(value, text, sizeof(text));
+      menu_renderer_puts(&renderer, COLS - strlen(text), row, text);
+    }
+  }
+  menu_renderer_flush(&renderer);
+
+  xTaskNotifyGive(bench);
+}
+
+static void bench_renderer_flush(int64_t *samples) {
+  uint32_t count = FLUSHES * scale;
+  uint32_t bytes = written_bytes;
+  int64_t start = esp_timer_get_time();
+
+  for (uint32_t i = 0; i < count; i++) {
+    int64_t frame_start = esp_timer_get_time();
+
+    menu_renderer_clear(&renderer);
+    menu_renderer_puts(&renderer, 0, 0, "Lights");
+    menu_renderer_putc(&renderer, 0, 1 + i % (ROWS - 1), '>');
+    for (uint8_t row = 1; row < ROWS; row++)
+      menu_renderer_puts(&renderer, 2, row, lights[row - 1].label);
+    menu_renderer_flush(&renderer);
+    samples[i] = esp_timer_get_time() - frame_start;
+  }
+
+  int64_t elapsed = esp_timer_get_time() - start;
+  fprintf(out,
+          "{\"bench\":\"renderer_flush\",\"name\":\"move_arrow\","
+          "\"ops_per_s\":%.0f,\"bytes_per_flush\":%.1f",
+          count * 1e6 / (elapsed ? elapsed : 1),
+          (double)(written_bytes - bytes) / count);
+  put_latency(samples, count);
+  fprintf(out, "}\n");
+}
+
+static bool bench_navigation(int64_t *samples) {
+  uint32_t passes = NAVIGATION_PASSES * scale;
+  uint32_t bytes = written_bytes;
+  uint32_t merged = ctx.merged;
+  size_t count = 0;
+  int64_t start = esp_timer_get_time();
+
+  for (uint32_t i = 0; i < passes; i++) {
+    for (size_t j = 0; j < PASS_COMMANDS; j++) {
+      int64_t command_start = esp_timer_get_time();
+
+      menu_ctx_send(&ctx, pass[j], portMAX_DELAY);
+      if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TIMEOUT_MS))) {
+        ESP_LOGE(TAG, "No frame after command %zu", j);
+        return false;
+      }
+      samples[count++] = esp_timer_get_time() - command_start;
+    }
+  }
+
+  int64_t elapsed = esp_timer_get_time() - start;
+  fprintf(out,
+          "{\"bench\":\"navigation\",\"name\":\"closed_loop\","
+          "\"commands_per_s\":%.0f,\"bytes_per_command\":%.1f,"
+          "\"merged\":%lu",
+          count * 1e6 / (elapsed ? elapsed : 1),
+          (double)(written_bytes - bytes) / count,
+          (unsigned long)(ctx.merged - merged));
+  put_latency(samples, count);
+  fprintf(out, "}\n");
+  return true;
+}
+
+static bool start_menu(void) {
+  menu_renderer_backend_t backend = {.set_cursor = screen_set_cursor,
+                                     .write = screen_write};
+
+  for (uint8_t i = 0; i < 8; i++) {
+    level_values[i] = (menu_value_t){
+        .type = MENU_VALUE_INT, .number = &levels[i], .min = 0, .max = 100};
+  }
+  ESP_ERROR_CHECK(menu_renderer_init(&renderer, COLS, ROWS, &backend));
+
+  config.root = (menu_node_t){
+      .label = "Bench", .submenus = root_options, .num_options = 3};
+  config.display = &display;
+  config.loop = true;
+  ESP_ERROR_CHECK(menu_ctx_create(&ctx, &config));
+  xTaskCreate(&menu_ctx_run, "menu", 4096, &ctx, 5, NULL);
+
+  // First frame of the root menu.
+  if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TIMEOUT_MS))) {
+    ESP_LOGE(TAG, "Menu did not draw");
+    return false;
+  }
+  return true;
+}
+
+void app_main(void) {
+  const char *path = getenv("BENCH_OUT");
+  const char *factor = getenv("BENCH_SCALE");
+  size_t max_samples;
+  int64_t *samples;
+  bool ok;
+
+  if (factor && strtoul(factor, NULL, 10))
+    scale = strtoul(factor, NULL, 10);
+  out = stdout;
+  if (path && !(out = fopen(path, "w"))) {
+    ESP_LOGE(TAG, "Cannot create %s", path);
+    exit(1);
+  }
+
+  max_samples = FLUSHES;
+  if (NAVIGATION_PASSES * PASS_COMMANDS > max_samples)
+    max_samples = NAVIGATION_PASSES * PASS_COMMANDS;
+  if (CHANNEL_UPDATES > max_samples)
+    max_samples = CHANNEL_UPDATES;
+  samples = malloc(max_samples * scale * sizeof(int64_t));
+  if (!samples) {
+    ESP_LOGE(TAG, "No memory for %zu samples", max_samples * scale);
+    exit(1);
+  }
+
+  // app_main runs below the dimmer and menu tasks, like on the device a
+  // command is handled before the call that sent it returns.
+  bench = xTaskGetCurrentTaskHandle();
+
+  fprintf(out,
+          "{\"bench\":\"config\",\"name\":\"host\",\"scale\":%u,"
+          "\"channels\":%u,\"cols\":%u,\"rows\":%u}\n",
+          scale, CHANNELS, COLS, ROWS);
+  bench_conversion();
+  ok = create_channels() && bench_channel_latency(samples) &&
+       bench_group_latency(samples) && bench_budget_latency(samples);
+  if (mismatches) {
+    ESP_LOGE(TAG, "%lu compare values differ from the group dutty",
+             (unsigned long)mismatches);
+    ok = false;
+  }
+  ok = ok && start_menu();
+  if (ok)
+    bench_renderer_flush(samples);
+  ok = ok && bench_navigation(samples);
+
+  free(samples);
+  // Closed by exit(), which flushes the stream.
+  exit(ok ? 0 : 1);
+}
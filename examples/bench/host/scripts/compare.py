@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Compare two result files of the host benchmark.
+
+    compare.py before.jsonl after.jsonl [--threshold 10]
+
+Records are matched by bench, name and channel. Every number found in both
+is printed with its change. Rates (*_per_s) are better higher, times (*_us)
+and byte counts better lower. A change worse than the threshold percent is
+marked and makes the exit status 1.
+"""
+
+import argparse
+import json
+import sys
+
+# Describe the run, not its speed.
+IGNORED = {'channel', 'channels', 'samples', 'ops', 'us', 'scale', 'cols', 'rows'}
+
+
+def load(path):
+    records = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            record = json.loads(line)
+            key = (record['bench'], record['name'], record.get('channel'))
+            records[key] = record
+    return records
+
+
+def higher_is_better(field):
+    return field.endswith('_per_s')
+
+
+def label(key):
+    bench, name, channel = key
+    text = f'{bench}/{name}'
+    return text if channel is None else f'{text}/{channel}'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('before')
+    parser.add_argument('after')
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='percent change reported as a regression')
+    args = parser.parse_args()
+
+    before = load(args.before)
+    after = load(args.after)
+    regressions = 0
+
+    for key in before:
+        if key not in after:
+            print(f'{label(key)}: missing in {args.after}')
+            continue
+        for field, old in before[key].items():
+            new = after[key].get(field)
+            if (field in IGNORED or not isinstance(old, (int, float))
+                    or not isinstance(new, (int, float))):
+                continue
+            change = (new - old) * 100.0 / old if old else 0.0
+            worse = -change if higher_is_better(field) else change
+            mark = ''
+            if worse > args.threshold:
+                mark = '  REGRESSION'
+                regressions += 1
+            print(f'{label(key):34} {field:18} {old:>12} {new:>12} '
+                  f'{change:+7.1f}%{mark}')
+    for key in after:
+        if key not in before:
+            print(f'{label(key)}: new in {args.after}')
+
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <dimmer.h>
+
+#define DIMMER_SYNC_GPIO   5
+
+#define DIMMER_0_GEN_GPIO  2
+#define DIMMER_1_GEN_GPIO  4
+#define DIMMER_2_GEN_GPIO  16
+
+static const char *TAG = "group_dimmer_example";
+
+static task_dimmer_t dimmer_0;
+static task_dimmer_t dimmer_1;
+static task_dimmer_t dimmer_2;
+static dimmer_group_t living_room;
+
+void app_main(void) {
+  printf("Group Dimmer Example\n");
+  dimmer_0 = create_task_dimmer( DIMMER_0_GEN_GPIO, DIMMER_SYNC_GPIO );
+  dimmer_1 = create_task_dimmer( DIMMER_1_GEN_GPIO, DIMMER_SYNC_GPIO );
+  dimmer_2 = create_task_dimmer( DIMMER_2_GEN_GPIO, DIMMER_SYNC_GPIO );
+
+  // Ceiling lamps follow the group, the wall lamp stays dimmer and never off
+  ESP_ERROR_CHECK(create_dimmer_group( &living_room, "living room" ));
+  ESP_ERROR_CHECK(add_dimmer_group_member( &living_room, &dimmer_0, 1.0f, 0 ));
+  ESP_ERROR_CHECK(add_dimmer_group_member( &living_room, &dimmer_1, 1.0f, 0 ));
+  ESP_ERROR_CHECK(add_dimmer_group_member( &living_room, &dimmer_2, 0.5f, 100 ));
+
+  dimmer_group_t *group = find_dimmer_group("living room");
+  ESP_LOGI(TAG, "Group %s with %u channels", group->name, group->count);
+
+  while(1) {
+    for( double i=0; i < 1; i+=.05) {
+      ESP_ERROR_CHECK(set_dimmer_group_power( group, i));
+      vTaskDelay(pdMS_TO_TICKS(50));
+    }
+    for( double i=1; i > 0; i-=.05) {
+      ESP_ERROR_CHECK(set_dimmer_group_power( group, i));
+      vTaskDelay(pdMS_TO_TICKS(50));
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+}
@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <dimmer.h>
+
+#define DIMMER_SYNC_GPIO   5
+
+#define DIMMER_0_GEN_GPIO  2
+#define DIMMER_1_GEN_GPIO  4
+#define DIMMER_2_GEN_GPIO  16
+
+// Breaker of the shared circuit, with some margin
+#define CIRCUIT_WATTS      1800
+
+static const char *TAG = "budget_dimmer_example";
+
+static task_dimmer_t heater;
+static task_dimmer_t lamp_0;
+static task_dimmer_t lamp_1;
+static dimmer_budget_t circuit;
+static dimmer_budget_channel_t channels[3];
+
+void app_main(void) {
+  printf("Power Budget Dimmer Example\n");
+  heater = create_task_dimmer( DIMMER_0_GEN_GPIO, DIMMER_SYNC_GPIO );
+  lamp_0 = create_task_dimmer( DIMMER_1_GEN_GPIO, DIMMER_SYNC_GPIO );
+  lamp_1 = create_task_dimmer( DIMMER_2_GEN_GPIO, DIMMER_SYNC_GPIO );
+
+  // Lamps are served first, the heater gets what is left
+  ESP_ERROR_CHECK(create_dimmer_budget( &circuit, CIRCUIT_WATTS ));
+  ESP_ERROR_CHECK(add_dimmer_budget_channel( &circuit, &channels[0], &lamp_0, 300, 0 ));
+  ESP_ERROR_CHECK(add_dimmer_budget_channel( &circuit, &channels[1], &lamp_1, 300, 0 ));
+  ESP_ERROR_CHECK(add_dimmer_budget_channel( &circuit, &channels[2], &heater, 2000, 1 ));
+
+  // The heater asks for full power all the time
+  ESP_ERROR_CHECK(set_task_dimmer_power( &heater, 1 ));
+
+  while(1) {
+    for( double i=0; i < 1; i+=.1) {
+      ESP_ERROR_CHECK(set_task_dimmer_power( &lamp_0, i));
+      ESP_ERROR_CHECK(set_task_dimmer_power( &lamp_1, i));
+      ESP_LOGI(TAG, "Lamps %.0f%%, heater %.0f%%, load %lu W", i * 100,
+               get_task_dimmer_power(&heater) * 100, (unsigned long)circuit.load);
+      vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+  }
+}
@@ -0,0 +1,89 @@
+#include <dimmer.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <menu_dimmer.h>
+#include <menu_manager.h>
+#include <sdkconfig.h>
+#include <stdio.h>
+
+static const char *TAG = "main";
+
+#define LAMP_GEN_GPIO 2
+#define FAN_GEN_GPIO 4
+#define SYNC_GPIO 5
+
+#define MENU_STACK 4096
+#define SIMULA_STACK 2048
+
+// Every task, queue and stack of the panel, nothing comes from the heap once
+// app_main() returns.
+static task_dimmer_static_t lamp_buffers;
+static task_dimmer_static_t fan_buffers;
+static menu_ctx_static_t menu_buffers;
+static StaticTask_t menu_task;
+static StackType_t menu_stack[MENU_STACK];
+static StaticTask_t simula_task;
+static StackType_t simula_stack[SIMULA_STACK];
+
+static task_dimmer_t lamp;
+static task_dimmer_t fan;
+
+// Filled by menu_dimmer_panel_init().
+menu_node_t root_options[1] = {
+    {.label = "Dimmers"},
+};
+
+// The menu only redraws when a readout of the open channel changed.
+void display(menu_path_t *current_path) {
+  char text[16];
+
+  ESP_LOGI(TAG, "%s", menu_path_title(current_path));
+  for (size_t i = 0; i < menu_path_num_options(current_path); i++) {
+    menu_value_t *value = menu_path_option_value(current_path, i);
+    text[0] = '\0';
+    if (value)
+      menu_value_format(value, text, sizeof(text));
+    ESP_LOGI(TAG, "%c %-10s %s", i == current_path->current_index ? '>' : ' ',
+             menu_path_option_label(current_path, i), text);
+  }
+}
+
+// Open the lamp channel, then keep changing its level outside the menu.
+void simula_input(void *args) {
+  Navigate_t command = NAVIGATE_SELECT;
+
+  vTaskDelay(pdMS_TO_TICKS(1000));
+  menu_send(command);
+  menu_send(command);
+
+  while (true) {
+    for (double power = 0; power < 1; power += .05) {
+      ESP_ERROR_CHECK(set_task_dimmer_power(&lamp, power));
+      vTaskDelay(pdMS_TO_TICKS(100));
+    }
+  }
+}
+
+void app_main(void) {
+  static menu_config_t config = {
+      .root = {.label = "root", .submenus = root_options, .num_options = 1},
+      .display = &display,
+  };
+
+  ESP_ERROR_CHECK(create_task_dimmer_static(&lamp, LAMP_GEN_GPIO, SYNC_GPIO,
+                                            &lamp_buffers));
+  ESP_ERROR_CHECK(
+      create_task_dimmer_static(&fan, FAN_GEN_GPIO, SYNC_GPIO, &fan_buffers));
+  ESP_ERROR_CHECK(menu_dimmer_add_task("Lamp", &lamp));
+  ESP_ERROR_CHECK(menu_dimmer_add_task("Fan", &fan));
+  ESP_ERROR_CHECK(menu_dimmer_panel_init(&root_options[0], NULL));
+
+  ESP_ERROR_CHECK(menu_default_ctx_create_static(&config, &menu_buffers));
+  xTaskCreateStaticPinnedToCore(&menu_ctx_run, "menu", MENU_STACK,
+                                menu_default_ctx(), 3, menu_stack, &menu_task,
+                                0);
+  xTaskCreateStaticPinnedToCore(&simula_input, "simula", SIMULA_STACK, NULL, 1,
+                                simula_stack, &simula_task, 0);
+}
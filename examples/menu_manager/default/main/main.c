@@ -24,39 +24,53 @@ menu_node_t submenu[3] = {
     {.label = "funcC", .function = &dumb},
 };
 
+size_t channels_count(void *arg) { return 64; }
+
+void channels_get(void *arg, size_t index, menu_node_t *child, char *label,
+                  size_t label_size) {
+  snprintf(label, label_size, "Channel %u", (unsigned)index + 1);
+  child->function = &dumb;
+}
+
+menu_virtual_t channels = {
+    .count = &channels_count,
+    .get_child = &channels_get,
+};
+
 menu_node_t root = {
     .label = "root",
-    .num_options = 3,
-    .submenus = (menu_node_t[3]){
+    .num_options = 4,
+    .submenus = (menu_node_t[4]){
         {.label = "submenu1", .submenus = submenu, .num_options = 3},
         {.label = "submenu2", .submenus = submenu, .num_options = 3},
         {.label = "submenu3", .submenus = submenu, .num_options = 3},
+        {.label = "channels", .virtual_menu = &channels},
     }};
 
 void simula_input(void *args) {
   Navigate_t teste = NAVIGATE_UP;
   vTaskDelay(6000 / portTICK_PERIOD_MS);
   ESP_LOGI(TAG, "NEXT");
-  xQueueSend(qCommands, &teste, portMAX_DELAY);
+  menu_send(teste);
   vTaskDelay(5000 / portTICK_PERIOD_MS);
   teste = NAVIGATE_SELECT;
   ESP_LOGI(TAG, "SELECT");
-  xQueueSend(qCommands, &teste, portMAX_DELAY);
+  menu_send(teste);
   vTaskDelay(5000 / portTICK_PERIOD_MS);
   teste = NAVIGATE_DOWN;
   ESP_LOGI(TAG, "DOWN");
-  xQueueSend(qCommands, &teste, portMAX_DELAY);
+  menu_send(teste);
   vTaskDelay(5000 / portTICK_PERIOD_MS);
   teste = NAVIGATE_SELECT;
   ESP_LOGI(TAG, "SELECT");
-  xQueueSend(qCommands, &teste, portMAX_DELAY);
+  menu_send(teste);
   vTaskDelay(5000 / portTICK_PERIOD_MS);
   teste = NAVIGATE_BACK;
   ESP_LOGI(TAG, "BACK");
-  xQueueSend(qCommands, &teste, portMAX_DELAY);
+  menu_send(teste);
   vTaskDelay(5000 / portTICK_PERIOD_MS);
   ESP_LOGI(TAG, "BACK");
-  xQueueSend(qCommands, &teste, portMAX_DELAY);
+  menu_send(teste);
   vTaskDelay(10000 / portTICK_PERIOD_MS);
 
   ESP_LOGI(TAG, "Finalizada");
@@ -65,12 +79,11 @@ void simula_input(void *args) {
 
 void display(menu_path_t *current_path) {
 
-  ESP_LOGI(TAG, "title: %s, index_select: %d",
-           current_path->current_menu->label, current_path->current_index);
+  ESP_LOGI(TAG, "title: %s, index_select: %d", menu_path_title(current_path),
+           current_path->current_index);
 
-  ESP_LOGI(
-      TAG, "Option Selected %s",
-      current_path->current_menu->submenus[current_path->current_index].label);
+  ESP_LOGI(TAG, "Option Selected %s",
+           menu_path_option_label(current_path, current_path->current_index));
 }
 
 void app_main(void) {
@@ -0,0 +1,59 @@
+#include <esp_log.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <menu_manager.h>
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "main_menu.h"
+
+static const char *TAG = "main";
+
+void dumb(void *args) {
+  ESP_LOGI(TAG, "I am dumb");
+  vTaskDelay(2000 / portTICK_PERIOD_MS);
+  END_MENU_FUNCTION;
+}
+
+void about(void *args) {
+  ESP_LOGI(TAG, "Menu tree in flash");
+  END_MENU_FUNCTION;
+}
+
+void simula_input(void *args) {
+  const Navigate_t script[] = {NAVIGATE_SELECT, NAVIGATE_UP, NAVIGATE_SELECT,
+                               NAVIGATE_BACK,   NAVIGATE_UP, NAVIGATE_UP,
+                               NAVIGATE_SELECT};
+
+  for (size_t i = 0; i < sizeof(script) / sizeof(script[0]); i++) {
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    menu_send(script[i]);
+  }
+
+  ESP_LOGI(TAG, "Finalizada");
+  vTaskDelete(NULL);
+}
+
+void display(menu_path_t *current_path) {
+  ESP_LOGI(TAG, "title: %s, index_select: %d", menu_path_title(current_path),
+           current_path->current_index);
+
+  ESP_LOGI(TAG, "Option Selected %s",
+           menu_path_option_label(current_path, current_path->current_index));
+}
+
+void app_main(void) {
+  static menu_config_t config = {
+      .tree = &main_menu,
+      .loop = true,
+      .display = &display,
+  };
+
+  xTaskCreatePinnedToCore(&menu_init, "menu_init", 2048, &config, 3, NULL, 0);
+  vTaskDelay(1000 / portTICK_PERIOD_MS);
+  xTaskCreatePinnedToCore(&simula_input, "simula", 2048, NULL, 1, NULL, 0);
+  vTaskDelete(NULL);
+}
@@ -0,0 +1,372 @@
+/*
+ * Bus cost of menu frames on an HD44780 behind a PCF8574.
+ *
+ * Draws menu scenarios with menu_renderer into the menu_hd44780 backend on
+ * a simulated I2C bus. The bus decodes the expander bytes like the display
+ * controller and checks the result against the frame, and counts I2C
+ * transactions and bytes. Every scenario is measured four ways: full
+ * redraw or changed runs only, one transaction per expander byte like
+ * pcf8574_port_write() or one write per flush.
+ *
+ * The icons scenario draws more glyphs than CGRAM slots while scrolling and
+ * reports the hits and misses of the renderer glyph cache.
+ *
+ * A second pass makes the bus take the time of a 400 kHz transfer and
+ * compares how long menu_renderer_flush() blocks with and without async.
+ */
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <menu_hd44780.h>
+#include <menu_renderer.h>
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "hd44780_bench";
+
+#define COLS 20
+#define ROWS 4
+#define I2C_HZ 400000
+
+// Same wiring as the lcd_encoder example.
+static const menu_hd44780_pins_t pins = {
+    .rs = 0, .e = 2, .d4 = 4, .d5 = 5, .d6 = 6, .d7 = 7, .bl = 3};
+
+// ------------------------------------------------------------ simulated bus
+
+typedef struct {
+  uint8_t port;
+  bool four_bit;
+  bool half;
+  uint8_t high;
+  uint8_t addr;
+  bool cgram;
+  char ddram[128];
+  uint8_t cgram_data[64];
+} controller_t;
+
+static controller_t controller;
+static bool bus_timed;
+
+static void Execute(uint8_t byte, bool rs) {
+  controller_t *c = &controller;
+
+  if (rs) {
+    if (c->cgram)
+      c->cgram_data[c->addr & 0x3F] = byte;
+    else
+      c->ddram[c->addr & 0x7F] = byte;
+    c->addr++;
+  } else if (byte & 0x80) {
+    c->addr = byte & 0x7F;
+    c->cgram = false;
+  } else if (byte & 0x40) {
+    c->addr = byte & 0x3F;
+    c->cgram = true;
+  } else if (byte & 0x20) {
+    c->four_bit = !(byte & 0x10);
+  } else if (byte == 0x01) {
+    memset(c->ddram, ' ', sizeof(c->ddram));
+    c->addr = 0;
+  }
+}
+
+// The controller reads the data lines when E goes low.
+static void Latch(uint8_t port) {
+  controller_t *c = &controller;
+  uint8_t nibble = (port >> pins.d4 & 1) | (port >> pins.d5 & 1) << 1 |
+                   (port >> pins.d6 & 1) << 2 | (port >> pins.d7 & 1) << 3;
+  bool rs = port >> pins.rs & 1;
+
+  if (!c->four_bit) {
+    Execute(nibble << 4, rs);
+  } else if (!c->half) {
+    c->high = nibble;
+    c->half = true;
+  } else {
+    Execute(c->high << 4 | nibble, rs);
+    c->half = false;
+  }
+}
+
+static esp_err_t bus_write(void *arg, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t e = 1 << pins.e;
+    if ((controller.port & e) && !(data[i] & e))
+      Latch(controller.port);
+    controller.port = data[i];
+  }
+
+  if (bus_timed) {
+    // Address and data bytes of 9 bits each, plus start and stop.
+    int64_t us = ((len + 1) * 9 + 2) * 1000000LL / I2C_HZ;
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end) {
+    }
+  }
+  return ESP_OK;
+}
+
+static bool ControllerShows(const menu_renderer_t *renderer) {
+  const uint8_t rows[ROWS] = {0x00, 0x40, COLS, 0x40 + COLS};
+
+  for (uint8_t row = 0; row < ROWS; row++) {
+    if (memcmp(&controller.ddram[rows[row]], &renderer->frame[row * COLS],
+               COLS) != 0) {
+      return false;
+    }
+  }
+
+  // Every glyph on screen must be in its slot.
+  for (size_t i = 0; i < COLS * ROWS; i++) {
+    uint8_t code = renderer->frame[i];
+    if (code < MENU_RENDERER_GLYPH_CODE ||
+        code >= MENU_RENDERER_GLYPH_CODE + MENU_RENDERER_GLYPH_SLOTS) {
+      continue;
+    }
+    uint8_t slot = code - MENU_RENDERER_GLYPH_CODE;
+    if (memcmp(&controller.cgram_data[slot * 8],
+               renderer->slots[slot].glyph->bitmap, 8) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------- scenarios
+
+static const char *items[8] = {"Brightness", "Contrast", "Backlight",
+                               "Language",   "Clock",    "Alarm",
+                               "Network",    "About"};
+
+// Arrow and one icon per item, more glyphs than CGRAM slots.
+static menu_renderer_glyph_t icons[9];
+
+static void MakeIcons(void) {
+  for (uint8_t i = 0; i < 9; i++) {
+    for (uint8_t row = 0; row < 8; row++)
+      icons[i].bitmap[row] = (i + 1) * (row + 3) & 0x1F;
+    icons[i].fallback = i ? '*' : '>';
+  }
+}
+
+static void DrawList(menu_renderer_t *renderer, const char *title,
+                     uint8_t select, bool with_icons) {
+  uint8_t first = select < ROWS - 1 ? 0 : select - (ROWS - 2);
+
+  menu_renderer_clear(renderer);
+  menu_renderer_puts(renderer, (COLS - strlen(title)) / 2, 0, title);
+  for (uint8_t row = 1; row < ROWS; row++) {
+    uint8_t item = first + row - 1;
+    uint8_t col = 0;
+    if (item == select) {
+      if (with_icons)
+        menu_renderer_put_glyph(renderer, col++, row, &icons[0]);
+      else
+        menu_renderer_putc(renderer, col++, row, '>');
+      menu_renderer_putc(renderer, col++, row, ' ');
+    }
+    menu_renderer_puts(renderer, col, row, items[item]);
+    if (with_icons)
+      menu_renderer_put_glyph(renderer, COLS - 1, row, &icons[1 + item]);
+  }
+}
+
+static void DrawValue(menu_renderer_t *renderer, int value) {
+  char text[8];
+
+  DrawList(renderer, "Display", 0, false);
+  snprintf(text, sizeof(text), "[%d]", value);
+  menu_renderer_puts(renderer, COLS - strlen(text), 1, text);
+}
+
+typedef enum {
+  SCENARIO_OPEN,
+  SCENARIO_SCROLL,
+  SCENARIO_EDIT,
+  SCENARIO_ICONS,
+  SCENARIO_COUNT,
+} scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = {
+    "open menu",
+    "scroll 8 items",
+    "edit value x10",
+    "icons scroll x3",
+};
+
+// Draw the frames of a scenario, from the frame before it.
+static int DrawScenario(menu_renderer_t *renderer, scenario_t scenario,
+                        int frame) {
+  switch (scenario) {
+  case SCENARIO_OPEN:
+    if (frame == 0)
+      DrawList(renderer, "Settings", 2, false);
+    else if (frame == 1)
+      DrawList(renderer, "Display", 0, false);
+    return 2;
+
+  case SCENARIO_SCROLL:
+    if (frame < 8)
+      DrawList(renderer, "Display", frame, false);
+    return 8;
+
+  case SCENARIO_EDIT:
+    if (frame < 11)
+      DrawValue(renderer, 5 + frame);
+    return 11;
+
+  case SCENARIO_ICONS:
+    // Down and up the list three times.
+    if (frame < 43)
+      DrawList(renderer, "Icons", frame % 14 < 7 ? frame % 14 : 14 - frame % 14,
+               true);
+    return 43;
+
+  default:
+    return 0;
+  }
+}
+
+typedef struct {
+  uint32_t frames;
+  uint32_t transactions;
+  uint32_t bytes;
+  uint32_t edge_transactions;
+} cost_t;
+
+static uint32_t BusMicros(uint32_t transactions, uint32_t bytes) {
+  return ((uint64_t)(bytes + transactions) * 9 + 2 * transactions) *
+         1000000ULL / I2C_HZ;
+}
+
+static void PrintCost(const char *scenario, const char *redraw,
+                      const cost_t *cost) {
+  uint32_t frames = cost->frames ? cost->frames : 1;
+
+  // One transaction per expander byte: bytes equals transactions.
+  printf("%-16s %-8s %6lu %8lu %9lu %9lu %10lu\n", scenario, redraw,
+         (unsigned long)(cost->bytes / frames),
+         (unsigned long)(cost->edge_transactions / frames),
+         (unsigned long)(BusMicros(cost->edge_transactions, cost->bytes) /
+                         frames),
+         (unsigned long)(cost->transactions / frames),
+         (unsigned long)(BusMicros(cost->transactions, cost->bytes) /
+                         frames));
+}
+
+static bool Measure(menu_renderer_t *renderer, menu_hd44780_t *lcd,
+                    scenario_t scenario, bool full, cost_t *cost) {
+  int frames = DrawScenario(renderer, scenario, 0);
+
+  // The first frame only sets up what the scenario starts from.
+  menu_renderer_invalidate(renderer);
+  menu_renderer_flush(renderer);
+  *cost = (cost_t){0};
+
+  for (int frame = 1; frame < frames; frame++) {
+    uint32_t transactions = lcd->transactions;
+    uint32_t bytes = lcd->bytes;
+
+    DrawScenario(renderer, scenario, frame);
+    if (full)
+      menu_renderer_invalidate(renderer);
+    menu_renderer_flush(renderer);
+    menu_hd44780_sync(lcd);
+
+    if (!ControllerShows(renderer)) {
+      ESP_LOGE(TAG, "%s: display differs from frame %d",
+               scenario_names[scenario], frame);
+      return false;
+    }
+    cost->frames++;
+    cost->transactions += lcd->transactions - transactions;
+    cost->bytes += lcd->bytes - bytes;
+    cost->edge_transactions += lcd->bytes - bytes;
+  }
+  return true;
+}
+
+static int64_t FlushTime(bool async) {
+  menu_hd44780_config_t config = {
+      .bus_write = bus_write,
+      .pins = pins,
+      .cols = COLS,
+      .rows = ROWS,
+      .backlight = true,
+      .async = async,
+  };
+  menu_hd44780_t lcd;
+  menu_renderer_backend_t backend;
+  menu_renderer_t renderer;
+  int64_t blocked = 0;
+
+  ESP_ERROR_CHECK(menu_hd44780_init(&lcd, &config));
+  menu_hd44780_backend(&lcd, &backend);
+  ESP_ERROR_CHECK(menu_renderer_init(&renderer, COLS, ROWS, &backend));
+
+  bus_timed = true;
+  for (int frame = 0; frame < 8; frame++) {
+    DrawList(&renderer, "Display", frame, false);
+    int64_t start = esp_timer_get_time();
+    menu_renderer_flush(&renderer);
+    blocked += esp_timer_get_time() - start;
+    // Work of the menu between two frames.
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  menu_hd44780_sync(&lcd);
+  bus_timed = false;
+
+  menu_renderer_deinit(&renderer);
+  menu_hd44780_deinit(&lcd);
+  return blocked / 8;
+}
+
+void app_main(void) {
+  menu_hd44780_config_t config = {
+      .bus_write = bus_write,
+      .pins = pins,
+      .cols = COLS,
+      .rows = ROWS,
+      .backlight = true,
+  };
+  menu_hd44780_t lcd;
+  menu_renderer_backend_t backend;
+  menu_renderer_t renderer;
+  bool ok = true;
+
+  MakeIcons();
+  ESP_ERROR_CHECK(menu_hd44780_init(&lcd, &config));
+  menu_hd44780_backend(&lcd, &backend);
+  ESP_ERROR_CHECK(menu_renderer_init(&renderer, COLS, ROWS, &backend));
+
+  printf("per frame, %d Hz bus           per-edge writes     combined\n",
+         I2C_HZ);
+  printf("%-16s %-8s %6s %8s %9s %9s %10s\n", "scenario", "redraw", "bytes",
+         "writes", "bus us", "writes", "bus us");
+  for (scenario_t scenario = 0; scenario < SCENARIO_COUNT; scenario++) {
+    cost_t full, diff;
+    ok &= Measure(&renderer, &lcd, scenario, true, &full);
+    ok &= Measure(&renderer, &lcd, scenario, false, &diff);
+    PrintCost(scenario_names[scenario], "full", &full);
+    PrintCost(scenario_names[scenario], "changed", &diff);
+  }
+  printf("glyph cache: %lu hits, %lu misses, %lu fallbacks\n",
+         (unsigned long)renderer.glyph_hits,
+         (unsigned long)renderer.glyph_misses,
+         (unsigned long)renderer.glyph_fallbacks);
+
+  menu_renderer_deinit(&renderer);
+  menu_hd44780_deinit(&lcd);
+
+  printf("flush blocks: sync %lld us, async %lld us\n",
+         (long long)FlushTime(false), (long long)FlushTime(true));
+  printf("display check: %s\n", ok ? "ok" : "FAILED");
+  exit(ok ? 0 : 1);
+}
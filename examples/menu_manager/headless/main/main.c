@@ -0,0 +1,522 @@
+/*
+ * Headless menu harness for the linux target.
+ *
+ * Replays an input script into a menu drawn on a virtual 20x4 display,
+ * compares the display with the golden frames of the script and reports
+ * throughput and command to frame latency. With CONFIG_MENU_TRACE it also
+ * prints the queue, process and show stages of the last commands.
+ *
+ * Script lines:
+ *   UP, DOWN, SELECT, BACK   send one command and wait for its frame
+ *   FRAME                    the next rows lines, "|...|", must match the
+ *                            virtual display
+ *   # ...                    comment
+ *
+ * Environment:
+ *   MENU_SCRIPT   script path, default scripts/navigation.txt
+ *   MENU_REPEAT   times the script is replayed for timing, default 100
+ *   MENU_RECORD   when set, print the commands with the frame after each
+ *                 one in script format instead of checking frames, to write
+ *                 new golden frames
+ *   MENU_MIRROR   file the menu_mirror stream of the display is written to,
+ *                 decode it with tools/menu_mirror.py
+ */
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <menu_manager.h>
+#include <menu_mirror.h>
+#include <menu_renderer.h>
+#include <menu_trace.h>
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "headless";
+
+#define COLS 20
+#define ROWS 4
+#define ARROW '>'
+#define MAX_STEPS 1024
+#define FRAME_TIMEOUT_MS 1000
+
+typedef enum {
+  STEP_COMMAND,
+  STEP_FRAME,
+} step_type_t;
+
+typedef struct {
+  step_type_t type;
+  Navigate_t command;
+  char frame[ROWS][COLS + 1];
+  unsigned line;
+} step_t;
+
+static step_t steps[MAX_STEPS];
+static size_t num_steps;
+
+// What the display shows, written only through the renderer backend.
+static char screen[ROWS][COLS];
+static uint8_t screen_col, screen_row;
+static uint32_t written_bytes;
+
+static menu_renderer_t renderer;
+static menu_mirror_t mirror;
+static TaskHandle_t harness;
+static menu_ctx_t ctx;
+static menu_config_t config;
+
+// ---------------------------------------------------------------- menu tree
+
+static void quick(void *args) { exitFunction(); }
+
+static menu_node_t submenu[3] = {
+    {.label = "funcA", .function = &quick},
+    {.label = "funcB", .function = &quick},
+    {.label = "funcC", .function = &quick},
+};
+
+static int32_t level = 5;
+static bool backlight = true;
+static int32_t mode = 1;
+
+static menu_value_t level_value = {
+    .type = MENU_VALUE_INT,
+    .number = &level,
+    .min = 0,
+    .max = 10,
+};
+
+static menu_value_t backlight_value = {
+    .type = MENU_VALUE_TOGGLE,
+    .flag = &backlight,
+};
+
+static menu_value_t mode_value = {
+    .type = MENU_VALUE_ENUM,
+    .number = &mode,
+    .min = 0,
+    .max = 2,
+    .options = (const char *const[]){"Eco", "Normal", "Boost"},
+};
+
+static menu_node_t settings[3] = {
+    {.label = "Level", .value = &level_value},
+    {.label = "Backlight", .value = &backlight_value},
+    {.label = "Mode", .value = &mode_value},
+};
+
+static size_t channels_count(void *arg) { return 64; }
+
+static void channels_get(void *arg, size_t index, menu_node_t *child,
+                         char *label, size_t label_size) {
+  snprintf(label, label_size, "Channel %u", (unsigned)index + 1);
+  child->function = &quick;
+}
+
+static menu_virtual_t channels = {
+    .count = &channels_count,
+    .get_child = &channels_get,
+};
+
+static menu_node_t root_options[4] = {
+    {.label = "submenu1", .submenus = submenu, .num_options = 3},
+    {.label = "Settings", .submenus = settings, .num_options = 3},
+    {.label = "channels", .virtual_menu = &channels},
+    {.label = "About", .function = &quick},
+};
+
+// ------------------------------------------------------------ virtual display
+
+static esp_err_t screen_set_cursor(void *arg, uint8_t col, uint8_t row) {
+  screen_col = col;
+  screen_row = row;
+  return ESP_OK;
+}
+
+static esp_err_t screen_write(void *arg, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (screen_col < COLS && screen_row < ROWS)
+      screen[screen_row][screen_col] = data[i];
+    screen_col++;
+  }
+  written_bytes += len;
+  return ESP_OK;
+}
+
+static esp_err_t mirror_write(void *arg, const uint8_t *data, size_t len) {
+  return fwrite(data, 1, len, (FILE *)arg) == len ? ESP_OK : ESP_FAIL;
+}
+
+static void put_value(const menu_path_t *current_path, uint16_t index,
+                      uint8_t row) {
+  menu_value_t *value = menu_path_option_value(current_path, index);
+  char text[COLS - 1];
+  char shown[COLS + 1];
+
+  if (!value)
+    return;
+
+  menu_value_format(value, text, sizeof(text));
+  if (current_path->editing && index == current_path->current_index) {
+    snprintf(shown, sizeof(shown), "[%s]", text);
+  } else {
+    snprintf(shown, sizeof(shown), "%s", text);
+  }
+  menu_renderer_puts(&renderer, COLS - strlen(shown), row, shown);
+}
+
+static void display(menu_path_t *current_path) {
+  static uint16_t first;
+  static const char *old_title;
+  uint16_t select = current_path->current_index;
+  uint16_t options = menu_path_num_options(current_path);
+  const char *title = menu_path_title(current_path);
+  size_t title_len = strlen(title);
+
+  if (old_title != title || select < first) {
+    first = select < ROWS - 1 ? 0 : select - (ROWS - 2);
+    old_title = title;
+  } else if (select >= first + ROWS - 1) {
+    first = select - (ROWS - 2);
+  }
+
+  menu_renderer_clear(&renderer);
+  menu_renderer_puts(&renderer, title_len < COLS ? (COLS - title_len) / 2 : 0,
+                     0, title);
+  for (uint8_t row = 1; row < ROWS && first + row - 1 < options; row++) {
+    uint16_t option = first + row - 1;
+    uint8_t col = 0;
+    if (option == select) {
+      menu_renderer_putc(&renderer, col++, row, ARROW);
+      menu_renderer_putc(&renderer, col++, row, ' ');
+    }
+    menu_renderer_puts(&renderer, col, row,
+                       menu_path_option_label(current_path, option));
+    put_value(current_path, option, row);
+  }
+  menu_renderer_flush(&renderer);
+
+  xTaskNotifyGive(harness);
+}
+
+// ------------------------------------------------------------------- script
+
+static bool parse_command(const char *word, Navigate_t *command) {
+  static const struct {
+    const char *name;
+    Navigate_t command;
+  } names[] = {
+      {"UP", NAVIGATE_UP},
+      {"DOWN", NAVIGATE_DOWN},
+      {"SELECT", NAVIGATE_SELECT},
+      {"BACK", NAVIGATE_BACK},
+  };
+
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(word, names[i].name) == 0) {
+      *command = names[i].command;
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char *command_name(Navigate_t command) {
+  switch (command) {
+  case NAVIGATE_UP:
+    return "UP";
+  case NAVIGATE_DOWN:
+    return "DOWN";
+  case NAVIGATE_SELECT:
+    return "SELECT";
+  case NAVIGATE_BACK:
+    return "BACK";
+  default:
+    return "?";
+  }
+}
+
+// Copy a "|...|" line into a frame row, false if it is not one.
+static bool parse_row(const char *line, char *row) {
+  size_t len = strlen(line);
+
+  if (len != COLS + 2 || line[0] != '|' || line[COLS + 1] != '|')
+    return false;
+  memcpy(row, line + 1, COLS);
+  row[COLS] = '\0';
+  return true;
+}
+
+static esp_err_t load_script(const char *path) {
+  char line[128];
+  unsigned number = 0;
+  FILE *file = fopen(path, "r");
+
+  if (!file) {
+    ESP_LOGE(TAG, "Cannot open %s", path);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    if (num_steps == MAX_STEPS) {
+      ESP_LOGE(TAG, "%s:%u: more than %d steps", path, number, MAX_STEPS);
+      fclose(file);
+      return ESP_ERR_NO_MEM;
+    }
+    step_t *step = &steps[num_steps++];
+    step->line = number;
+
+    if (strcmp(line, "FRAME") == 0) {
+      step->type = STEP_FRAME;
+      for (uint8_t row = 0; row < ROWS; row++) {
+        number++;
+        if (!fgets(line, sizeof(line), file)) {
+          line[0] = '\0';
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!parse_row(line, step->frame[row])) {
+          ESP_LOGE(TAG, "%s:%u: expected |%d characters|", path, number,
+                   COLS);
+          fclose(file);
+          return ESP_ERR_INVALID_ARG;
+        }
+      }
+    } else if (parse_command(line, &step->command)) {
+      step->type = STEP_COMMAND;
+    } else {
+      ESP_LOGE(TAG, "%s:%u: unknown step \"%s\"", path, number, line);
+      fclose(file);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+
+  fclose(file);
+  return ESP_OK;
+}
+
+static void print_frame(void) {
+  printf("FRAME\n");
+  for (uint8_t row = 0; row < ROWS; row++)
+    printf("|%.*s|\n", COLS, screen[row]);
+}
+
+static bool check_frame(const step_t *step) {
+  bool match = true;
+
+  for (uint8_t row = 0; row < ROWS; row++)
+    match &= memcmp(screen[row], step->frame[row], COLS) == 0;
+  if (match)
+    return true;
+
+  printf("Frame mismatch at script line %u\nexpected:\n", step->line);
+  for (uint8_t row = 0; row < ROWS; row++)
+    printf("|%s|\n", step->frame[row]);
+  printf("got:\n");
+  for (uint8_t row = 0; row < ROWS; row++)
+    printf("|%.*s|\n", COLS, screen[row]);
+  return false;
+}
+
+// ------------------------------------------------------------------- replay
+
+static int compare_latency(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int64_t percentile(const int64_t *sorted, size_t count,
+                          unsigned percent) {
+  size_t rank = (count * percent + 99) / 100;
+  return sorted[rank ? rank - 1 : 0];
+}
+
+#if CONFIG_MENU_TRACE
+static void print_stage(const char *name, const menu_trace_stat_t *stat) {
+  printf("  %-8s n %4lu min %6lu avg %6lu max %6lu |", name,
+         (unsigned long)stat->count, (unsigned long)stat->min,
+         (unsigned long)stat->avg, (unsigned long)stat->max);
+  for (int i = 0; i < MENU_TRACE_BUCKETS; i++)
+    printf(" %lu", (unsigned long)stat->histogram[i]);
+  printf("\n");
+}
+
+// Stages of the last CONFIG_MENU_TRACE_SIZE commands.
+static void print_trace(void) {
+  menu_trace_summary_t summary;
+
+  menu_trace_summary(&ctx, &summary);
+  printf("trace us: %lu records, %lu without frame\n",
+         (unsigned long)summary.records, (unsigned long)summary.unshown);
+  print_stage("queue", &summary.queue);
+  print_stage("process", &summary.process);
+  print_stage("show", &summary.show);
+  print_stage("total", &summary.total);
+}
+#endif
+
+// Send one command and wait for the frame it causes.
+static bool send_command(Navigate_t command, int64_t *latency) {
+  int64_t start = esp_timer_get_time();
+
+  menu_ctx_send(&ctx, command, portMAX_DELAY);
+  if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FRAME_TIMEOUT_MS))) {
+    ESP_LOGE(TAG, "No frame after %s", command_name(command));
+    return false;
+  }
+  *latency = esp_timer_get_time() - start;
+  return true;
+}
+
+static int replay(unsigned repeat, bool record) {
+  size_t commands = 0;
+  size_t frames = 0, matched = 0;
+
+  for (size_t i = 0; i < num_steps; i++)
+    commands += steps[i].type == STEP_COMMAND;
+  if (!commands) {
+    ESP_LOGE(TAG, "Script has no commands");
+    return 1;
+  }
+
+  int64_t *latency = malloc(commands * repeat * sizeof(int64_t));
+  if (!latency) {
+    ESP_LOGE(TAG, "No memory for %zu samples", commands * repeat);
+    return 1;
+  }
+
+  size_t samples = 0;
+  uint32_t bytes_start = written_bytes;
+  int64_t start = esp_timer_get_time();
+
+  for (unsigned pass = 0; pass < repeat; pass++) {
+    // Values and saved indexes keep their state between passes, so only
+    // the first pass is compared with the golden frames.
+    for (size_t i = 0; i < num_steps; i++) {
+      const step_t *step = &steps[i];
+
+      if (step->type == STEP_COMMAND) {
+        if (!send_command(step->command, &latency[samples++])) {
+          free(latency);
+          return 1;
+        }
+        if (record && pass == 0) {
+          printf("%s\n", command_name(step->command));
+          print_frame();
+        }
+      } else if (pass == 0 && !record) {
+        frames++;
+        matched += check_frame(step);
+      }
+    }
+    // Start every pass from the root menu.
+    while (ctx.depth) {
+      int64_t ignored;
+      if (!send_command(NAVIGATE_BACK, &ignored)) {
+        free(latency);
+        return 1;
+      }
+    }
+  }
+
+  int64_t elapsed = esp_timer_get_time() - start;
+  uint32_t bytes = written_bytes - bytes_start;
+
+  qsort(latency, samples, sizeof(int64_t), compare_latency);
+  printf("commands: %zu in %lld us, %.0f cmd/s\n", samples,
+         (long long)elapsed, samples * 1e6 / (elapsed ? elapsed : 1));
+  printf("latency us: p50 %lld p90 %lld p99 %lld max %lld\n",
+         (long long)percentile(latency, samples, 50),
+         (long long)percentile(latency, samples, 90),
+         (long long)percentile(latency, samples, 99),
+         (long long)latency[samples - 1]);
+  printf("display: %.1f bytes/command\n", (double)bytes / samples);
+  printf("merged commands: %lu\n", (unsigned long)ctx.merged);
+#if CONFIG_MENU_TRACE
+  print_trace();
+#endif
+  if (!record)
+    printf("frames: %zu/%zu match\n", matched, frames);
+
+  free(latency);
+  return matched == frames ? 0 : 1;
+}
+
+void app_main(void) {
+  const char *script = getenv("MENU_SCRIPT");
+  const char *repeat = getenv("MENU_REPEAT");
+  bool record = getenv("MENU_RECORD") != NULL;
+  const char *capture = getenv("MENU_MIRROR");
+  menu_renderer_backend_t backend = {.set_cursor = screen_set_cursor,
+                                     .write = screen_write};
+  unsigned passes = repeat ? strtoul(repeat, NULL, 10) : 100;
+
+  if (!script)
+    script = SCRIPT_DIR "/navigation.txt";
+  if (!passes)
+    passes = 1;
+
+  harness = xTaskGetCurrentTaskHandle();
+  memset(screen, ' ', sizeof(screen));
+  ESP_ERROR_CHECK(load_script(script));
+
+  if (capture) {
+    FILE *file = fopen(capture, "wb");
+    if (!file) {
+      ESP_LOGE(TAG, "Cannot create %s", capture);
+      exit(1);
+    }
+    // Closed by exit(), which flushes the stream.
+    ESP_ERROR_CHECK(menu_mirror_init(
+        &mirror, &(menu_mirror_config_t){.write = mirror_write,
+                                         .arg = file,
+                                         .display = &backend,
+                                         .renderer = &renderer,
+                                         .ctx = &ctx}));
+    menu_mirror_backend(&mirror, &backend);
+  }
+#if CONFIG_MENU_NO_HEAP
+  static char framebuffers[MENU_RENDERER_BUFFER_SIZE(COLS, ROWS)];
+  ESP_ERROR_CHECK(
+      menu_renderer_init_static(&renderer, COLS, ROWS, &backend, framebuffers));
+#else
+  ESP_ERROR_CHECK(menu_renderer_init(&renderer, COLS, ROWS, &backend));
+#endif
+
+  config.root = (menu_node_t){
+      .label = "root", .submenus = root_options, .num_options = 4};
+  config.display = &display;
+  config.loop = false;
+#if CONFIG_MENU_NO_HEAP
+  static menu_ctx_static_t buffers;
+  static StaticTask_t menu_task;
+  static StackType_t menu_stack[4096];
+  ESP_ERROR_CHECK(menu_ctx_create_static(&ctx, &config, &buffers));
+  xTaskCreateStatic(&menu_ctx_run, "menu", 4096, &ctx, 5, menu_stack,
+                    &menu_task);
+#else
+  ESP_ERROR_CHECK(menu_ctx_create(&ctx, &config));
+  xTaskCreate(&menu_ctx_run, "menu", 4096, &ctx, 5, NULL);
+#endif
+
+  // First frame of the root menu.
+  if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FRAME_TIMEOUT_MS))) {
+    ESP_LOGE(TAG, "Menu did not draw");
+    exit(1);
+  }
+  if (record)
+    print_frame();
+
+  exit(replay(passes, record));
+}
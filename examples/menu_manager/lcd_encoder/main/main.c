@@ -1,7 +1,6 @@
 #include "esp_err.h"
 #include "freertos/portmacro.h"
 #include "i2cdev.h"
-#include <encoder.h>
 #include <esp_idf_lib_helpers.h>
 #include <esp_log.h>
 #include <esp_system.h>
@@ -9,8 +8,11 @@
 #include <freertos/queue.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
-#include <hd44780.h>
+#include <menu_hd44780.h>
+#include <menu_input.h>
 #include <menu_manager.h>
+#include <menu_renderer.h>
+#include <nvs_flash.h>
 #include <pcf8574.h>
 #include <sdkconfig.h>
 #include <stdbool.h>
@@ -29,6 +31,13 @@ menu_node_t submenu[3] = {
     {.label = "funcC", .function = &dumb},
 };
 
+bool blacklight = true;
+menu_value_t blacklight_value = {
+    .type = MENU_VALUE_TOGGLE,
+    .flag = &blacklight,
+    .on_change = &blacklight_changed,
+};
+
 menu_node_t root = {
     .label = "root",
     .num_options = 5,
@@ -37,34 +46,36 @@ menu_node_t root = {
         {.label = "submenu2", .submenus = submenu, .num_options = 3},
         {.label = "submenu3", .submenus = submenu, .num_options = 3},
         {.label = "Menu: type 1", .function = &switch_menu},
-        {.label = "blacklight", .function = &switch_blacklight},
+        {.label = "blacklight", .value = &blacklight_value},
     }};
 
-QueueHandle_t qinput;
-static rotary_encoder_t re = {
+static menu_input_encoder_t re = {
     .pin_a = CONFIG_ENCODER_CLK,
     .pin_b = CONFIG_ENCODER_DT,
-    .pin_btn = CONFIG_ENCODER_SW,
+};
+
+static menu_input_button_t re_button = {
+    .gpio = CONFIG_ENCODER_SW,
+    .command = NAVIGATE_SELECT,
+    .long_command = NAVIGATE_BACK,
 };
 
 static i2c_dev_t pcf8574;
 
-static esp_err_t write_lcd_data(const hd44780_t *lcd, uint8_t data) {
-  return pcf8574_port_write(&pcf8574, data);
+// A whole flush goes out in one I2C write instead of one per E edge.
+static esp_err_t lcd_bus_write(void *arg, const uint8_t *data, size_t len) {
+  i2c_dev_t *dev = (i2c_dev_t *)arg;
+
+  I2C_DEV_TAKE_MUTEX(dev);
+  I2C_DEV_CHECK(dev, i2c_dev_write(dev, NULL, 0, data, len));
+  I2C_DEV_GIVE_MUTEX(dev);
+  return ESP_OK;
 }
 
-hd44780_t lcd = {.write_cb = write_lcd_data,
-                 .font = HD44780_FONT_5X8,
-                 .lines = CONFIG_VERTICAL_SIZE,
-                 .pins = {
-                     .rs = 0,
-                     .e = 2,
-                     .d4 = 4,
-                     .d5 = 5,
-                     .d6 = 6,
-                     .d7 = 7,
-                     .bl = 3,
-                 }};
+static menu_hd44780_t lcd;
+static menu_renderer_backend_t lcd_backend;
+
+static menu_renderer_t renderer;
 
 menu_config_t config;
 
@@ -74,19 +85,37 @@ switch_menu_t options_display[2] = {
     {.type_menu = &display_loop, .loop_menu = true, .label = "Menu: type 2"},
 };
 
-bool blacklight = true;
-uint8_t first = 0, end = 0;
+uint16_t first = 0, end = 0;
 const char *old_title;
 
-static const uint8_t char_data[] = { // Define new chars
-                                     // Right Arrow
-    0x00, 0x04, 0x06, 0x1F, 0x1F, 0x06, 0x04, 0x00};
+// Uploaded into CGRAM by the renderer when a frame first uses them.
+static const menu_renderer_glyph_t arrow = {
+    .bitmap = {0x00, 0x04, 0x06, 0x1F, 0x1F, 0x06, 0x04, 0x00},
+    .fallback = '>',
+};
+static const menu_renderer_glyph_t checked = {
+    .bitmap = {0x00, 0x1F, 0x11, 0x1B, 0x15, 0x1B, 0x11, 0x1F},
+    .fallback = 'X',
+};
+static const menu_renderer_glyph_t unchecked = {
+    .bitmap = {0x00, 0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F},
+    .fallback = '-',
+};
 
 void app_main(void) {
   config.root = root;
-  config.input = &map;
   config.display = &display;
   config.loop = false;
+  // Reopened after a reboot with CONFIG_MENU_PERSIST.
+  config.persist_key = "lcd_menu";
+
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES ||
+      err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    err = nvs_flash_init();
+  }
+  ESP_ERROR_CHECK(err);
 
   ESP_ERROR_CHECK(start_lcd());
   ESP_ERROR_CHECK(start_encoder());
@@ -95,40 +124,19 @@ void app_main(void) {
   vTaskDelete(NULL);
 }
 
+// Encoder and its button post straight into the default menu queue from
+// their interrupts, input before menu_init() has created it is dropped.
 esp_err_t start_encoder(void) {
-  qinput = xQueueCreate(5, sizeof(rotary_encoder_event_t));
-
-  ESP_ERROR_CHECK(rotary_encoder_init(qinput));
-  ESP_ERROR_CHECK(rotary_encoder_add(&re));
+  ESP_ERROR_CHECK(menu_input_encoder_add(&re, NULL));
+  ESP_ERROR_CHECK(menu_input_button_add(&re_button, NULL));
   return ESP_OK;
 }
 
-Navigate_t map(void) {
-  rotary_encoder_event_t e;
-  xQueueReceive(qinput, &e, portMAX_DELAY);
-
-  switch (e.type) {
-
-  case RE_ET_BTN_CLICKED:
-    ESP_LOGI(TAG, "SELECT");
-    return NAVIGATE_SELECT;
-
-  case RE_ET_BTN_LONG_PRESSED:
-    ESP_LOGI(TAG, "BACK");
-    return NAVIGATE_BACK;
-
-  case RE_ET_CHANGED:
-    if (e.diff > 0) {
-      ESP_LOGI(TAG, "UP");
-      return NAVIGATE_UP;
-    } else {
-      ESP_LOGI(TAG, "DOWN");
-      return NAVIGATE_DOWN;
-    }
-  default:
-    ESP_LOGI(TAG, "NOTHIN");
-    return map();
-  }
+// Steps of the marquee timer redraw through the menu task.
+static void marquee_redraw(void *arg) {
+  menu_ctx_t *ctx = menu_default_ctx();
+  if (ctx)
+    menu_ctx_send(ctx, NAVIGATE_REFRESH, 0);
 }
 
 esp_err_t start_lcd(void) {
@@ -136,22 +144,89 @@ esp_err_t start_lcd(void) {
   ESP_ERROR_CHECK(pcf8574_init_desc(&pcf8574, CONFIG_DISPLAY_ADDR, 0,
                                     CONFIG_I2C_SDA, CONFIG_I2C_SCL));
 
-  hd44780_switch_backlight(&lcd, blacklight);
-  ESP_ERROR_CHECK(hd44780_init(&lcd));
-  hd44780_upload_character(&lcd, 0, char_data);
+  ESP_ERROR_CHECK(menu_hd44780_init(
+      &lcd, &(menu_hd44780_config_t){
+                .bus_write = lcd_bus_write,
+                .arg = &pcf8574,
+                .pins = {.rs = 0, .e = 2, .d4 = 4, .d5 = 5, .d6 = 6, .d7 = 7,
+                         .bl = 3},
+                .cols = CONFIG_HORIZONTAL_SIZE,
+                .rows = CONFIG_VERTICAL_SIZE,
+                .backlight = blacklight,
+                .async = true,
+            }));
+  menu_hd44780_backend(&lcd, &lcd_backend);
+  ESP_ERROR_CHECK(menu_renderer_init(&renderer, CONFIG_HORIZONTAL_SIZE,
+                                     CONFIG_VERTICAL_SIZE, &lcd_backend));
+  menu_renderer_set_marquee(&renderer, marquee_redraw, NULL);
   ESP_LOGI(TAG, "LCD ON!");
 
   return ESP_OK;
 }
 
+// Value of a widget option right aligned, in brackets while it is edited and
+// as a checkbox for toggles. Returns its first column.
+static uint8_t put_value(const menu_path_t *current_path, uint16_t index,
+                         uint8_t row) {
+  menu_value_t *value = menu_path_option_value(current_path, index);
+  char text[CONFIG_HORIZONTAL_SIZE + 1];
+  char shown[CONFIG_HORIZONTAL_SIZE + 1];
+
+  if (!value)
+    return CONFIG_HORIZONTAL_SIZE;
+
+  if (value->type == MENU_VALUE_TOGGLE) {
+    menu_renderer_put_glyph(&renderer, CONFIG_HORIZONTAL_SIZE - 1, row,
+                            *value->flag ? &checked : &unchecked);
+    return CONFIG_HORIZONTAL_SIZE - 1;
+  }
+
+  menu_value_format(value, text, sizeof(text));
+  if (current_path->editing && index == current_path->current_index) {
+    snprintf(shown, sizeof(shown), "[%s]", text);
+  } else {
+    snprintf(shown, sizeof(shown), "%s", text);
+  }
+  uint8_t col = CONFIG_HORIZONTAL_SIZE - strlen(shown);
+  menu_renderer_puts(&renderer, col, row, shown);
+  return col;
+}
+
+// Titles wider than the display scroll instead of being centred.
+static void put_title(const char *title) {
+  size_t len = strlen(title);
+
+  if (len > CONFIG_HORIZONTAL_SIZE) {
+    menu_renderer_marquee(&renderer, 0, 0, CONFIG_HORIZONTAL_SIZE, title);
+  } else {
+    menu_renderer_puts(&renderer, (CONFIG_HORIZONTAL_SIZE - len) / 2, 0,
+                       title);
+  }
+}
+
+// Selected option behind the arrow, a long label scrolls between the arrow
+// and its value.
+static void put_selected(const menu_path_t *current_path, uint16_t index,
+                         uint8_t row) {
+  uint8_t value_col = put_value(current_path, index, row);
+  uint8_t width = value_col > 2 ? value_col - 2 : 0;
+
+  // Keep a space before the value.
+  if (value_col < CONFIG_HORIZONTAL_SIZE && width > 0)
+    width--;
+  menu_renderer_put_glyph(&renderer, 0, row, &arrow);
+  menu_renderer_marquee(&renderer, 2, row, width,
+                        menu_path_option_label(current_path, index));
+}
+
 void display(menu_path_t *current_path) {
-  uint8_t select = current_path->current_index;
+  uint16_t select = current_path->current_index;
+  uint16_t options = menu_path_num_options(current_path);
   uint8_t count = 1;
-  char *title = current_path->current_menu->label;
+  const char *title = menu_path_title(current_path);
 
-  hd44780_clear(&lcd);
-  hd44780_gotoxy(&lcd, (CONFIG_HORIZONTAL_SIZE - strlen(title)) / 2, 0);
-  hd44780_puts(&lcd, title);
+  menu_renderer_clear(&renderer);
+  put_title(title);
   if (select < first || select == 0) {
     first = select;
     end = first + CONFIG_VERTICAL_SIZE - 1;
@@ -162,69 +237,67 @@ void display(menu_path_t *current_path) {
     old_title = title;
   }
 
-  for (uint8_t _ = first; _ < end; _++) {
-    hd44780_gotoxy(&lcd, 0, count);
-    count++;
+  for (uint16_t _ = first; _ < end && _ < options; _++) {
     if (_ == select) {
-      hd44780_putc(&lcd, 0);
-      hd44780_putc(&lcd, ' ');
+      put_selected(current_path, _, count);
+    } else {
+      menu_renderer_puts(&renderer, 0, count,
+                         menu_path_option_label(current_path, _));
+      put_value(current_path, _, count);
     }
-    hd44780_puts(&lcd, current_path->current_menu->submenus[_].label);
+    count++;
   }
+  menu_renderer_flush(&renderer);
 }
 
 void display_loop(menu_path_t *current_path) {
-  char *title = current_path->current_menu->label;
-
-  uint8_t select = current_path->current_index;
-  uint8_t prev = (current_path->current_menu->num_options + select - 1) %
-                 current_path->current_menu->num_options;
-  uint8_t next = (select + 1) % current_path->current_menu->num_options;
-
-  const char *prev_label = current_path->current_menu->submenus[prev].label;
-  const char *select_label = current_path->current_menu->submenus[select].label;
-  const char *next_label = current_path->current_menu->submenus[next].label;
-
-  uint8_t central_title = (CONFIG_HORIZONTAL_SIZE - strlen(title)) / 2;
-  hd44780_clear(&lcd);
-  hd44780_gotoxy(&lcd, central_title, 0);
-  hd44780_puts(&lcd, title);
-  hd44780_gotoxy(&lcd, 0, 1);
-  hd44780_puts(&lcd, prev_label);
-  hd44780_gotoxy(&lcd, 0, 2);
-  hd44780_putc(&lcd, 0);
-  hd44780_putc(&lcd, ' ');
-  hd44780_puts(&lcd, select_label);
-  hd44780_gotoxy(&lcd, 0, 3);
-  hd44780_puts(&lcd, next_label);
+  const char *title = menu_path_title(current_path);
+
+  uint16_t options = menu_path_num_options(current_path);
+  uint16_t select = current_path->current_index;
+
+  menu_renderer_clear(&renderer);
+  put_title(title);
+  // An empty submenu shows only its title.
+  if (options == 0) {
+    menu_renderer_flush(&renderer);
+    return;
+  }
+
+  uint16_t prev = (options + select - 1) % options;
+  uint16_t next = (select + 1) % options;
+
+  const char *prev_label = menu_path_option_label(current_path, prev);
+  const char *next_label = menu_path_option_label(current_path, next);
+
+  menu_renderer_puts(&renderer, 0, 1, prev_label);
+  put_value(current_path, prev, 1);
+  put_selected(current_path, select, 2);
+  menu_renderer_puts(&renderer, 0, 3, next_label);
+  put_value(current_path, next, 3);
+  menu_renderer_flush(&renderer);
 }
 
 void dumb(void *args) {
-  hd44780_clear(&lcd);
-  hd44780_puts(&lcd, "I");
-  hd44780_gotoxy(&lcd, 0, 1);
-  hd44780_puts(&lcd, "am");
-  hd44780_gotoxy(&lcd, 0, 2);
-  hd44780_puts(&lcd, "dumb   or");
-  hd44780_gotoxy(&lcd, 0, 3);
-  hd44780_puts(&lcd, "dummy");
+  menu_renderer_clear(&renderer);
+  menu_renderer_puts(&renderer, 0, 0, "I");
+  menu_renderer_puts(&renderer, 0, 1, "am");
+  menu_renderer_puts(&renderer, 0, 2, "dumb   or");
+  menu_renderer_puts(&renderer, 0, 3, "dummy");
+  menu_renderer_flush(&renderer);
   vTaskDelay(5000 / portTICK_PERIOD_MS);
 
-  hd44780_clear(&lcd);
-  hd44780_puts(&lcd, "FINISH:");
-  hd44780_gotoxy(&lcd, 0, 1);
-  hd44780_puts(&lcd, "dumb function");
+  menu_renderer_clear(&renderer);
+  menu_renderer_puts(&renderer, 0, 0, "FINISH:");
+  menu_renderer_puts(&renderer, 0, 1, "dumb function");
+  menu_renderer_flush(&renderer);
   ESP_LOGI(TAG, "FINISH I am dumb");
 
   END_MENU_FUNCTION;
 }
 
-void switch_blacklight(void *args) {
-  blacklight = !blacklight;
-  hd44780_switch_backlight(&lcd, blacklight);
-
-  SET_QUICK_FUNCTION;
-  END_MENU_FUNCTION;
+void blacklight_changed(menu_value_t *value, void *arg) {
+  menu_hd44780_set_backlight(&lcd, blacklight);
 }
 
 void switch_menu(void *args) {
@@ -1,5 +1,4 @@
 #include <esp_err.h>
-#include <hd44780.h>
 #include <menu_manager.h>
 
 esp_err_t start_lcd(void);
@@ -8,13 +7,11 @@ void display(menu_path_t *current_path);
 
 void display_loop(menu_path_t *current_path);
 
-Navigate_t map(void);
-
 esp_err_t start_encoder(void);
 
 // functions
 
-void switch_blacklight(void *args);
+void blacklight_changed(menu_value_t *value, void *arg);
 
 typedef struct {
   void (*type_menu)(menu_path_t *current_path);